@@ -91,6 +91,15 @@ void AppTcpServer::stop() {
     server_->stop();
 }
 
+void AppTcpServer::enableWatchdog(const std::chrono::milliseconds& threshold, bool dumpBacktrace) {
+    server_->enableWatchdog(threshold, dumpBacktrace);
+}
+
+void AppTcpServer::broadcast(const std::shared_ptr<const std::string>& msgPtr,
+                             const std::vector<TcpConnectionPtr>& conns) {
+    server_->broadcast(msgPtr, conns);
+}
+
 void AppTcpServer::registerBusinessHandler(ProtocolType type, const BusinessHandler& handler) {
     assert(mode_ == BUSINESS_MODE);
     businessHandlers_[type] = handler;
@@ -70,6 +70,20 @@ public:
      */
     void setConnectionCallback(const ConnectionCallback& cb);
 
+    /**
+     * @brief enable the watchdog of event loops, see TcpServer::enableWatchdog()
+     * @param threshold
+     * @param dumpBacktrace
+     */
+    void enableWatchdog(const std::chrono::milliseconds& threshold, bool dumpBacktrace = false);
+
+    /**
+     * @brief send the same data to the connections, see TcpServer::broadcast()
+     * @param msgPtr
+     * @param conns
+     */
+    void broadcast(const std::shared_ptr<const std::string>& msgPtr, const std::vector<TcpConnectionPtr>& conns);
+
     /**
      * set sock opt callback
      * @param cb
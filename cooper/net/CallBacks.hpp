@@ -11,15 +11,18 @@ using TimerCallback = std::function<void()>;
 // the data has been read to (buf, len)
 class TcpConnection;
 class MsgBuffer;
+class RingBuffer;
 class MultipartFormData;
 
 using TcpConnectionPtr = std::shared_ptr<TcpConnection>;
 // tcp server and connection callback
 using RecvMessageCallback = std::function<void(const TcpConnectionPtr&, MsgBuffer*)>;
+using RecvRingMessageCallback = std::function<void(const TcpConnectionPtr&, RingBuffer*)>;
 using ConnectionErrorCallback = std::function<void()>;
 using ConnectionCallback = std::function<void(const TcpConnectionPtr&)>;
 using CloseCallback = std::function<void(const TcpConnectionPtr&)>;
 using WriteCompleteCallback = std::function<void(const TcpConnectionPtr&)>;
+using SendCompleteCallback = std::function<void(bool)>;
 using HighWaterMarkCallback = std::function<void(const TcpConnectionPtr&, const size_t)>;
 using SSLErrorCallback = std::function<void(SSLError)>;
 using SockOptCallback = std::function<void(int)>;
@@ -1,6 +1,7 @@
 #include "Channel.hpp"
 
 #include <poll.h>
+#include <sys/epoll.h>
 
 #include <iostream>
 
@@ -20,13 +21,38 @@ void Channel::remove() {
     loop_->removeChannel(this);
 }
 
+void Channel::enableEdgeTriggered() {
+    assert(events_ == kNoneEvent);
+    if (loop_->pollerType() != PollerType::kEpoll) {
+        LOG_DEBUG << "edge-triggered mode is only supported by epoll, fd=" << fd_;
+        return;
+    }
+    edgeTriggered_ = true;
+}
+
 void Channel::update() {
+    if (edgeTriggered_) {
+        // The registration only changes when the first event is enabled or the
+        // last one is disabled.
+        bool registered = events_ != kNoneEvent;
+        if (registered == edgeRegistered_)
+            return;
+        edgeRegistered_ = registered;
+    }
     loop_->updateChannel(this);
 }
 
+int Channel::pollEvents() const {
+    if (edgeTriggered_ && events_ != kNoneEvent)
+        return kReadEvent | kWriteEvent | POLLRDHUP | EPOLLET;
+    return events_;
+}
+
 void Channel::handleEvent() {
     // LOG_TRACE<<"revents_="<<revents_;
-    if (events_ == kNoneEvent)
+    // The data of a completed read is delivered even if the reading has been
+    // disabled since it was started.
+    if (events_ == kNoneEvent && !recvCompleted_ && !sendCompleted_)
         return;
     if (tied_) {
         std::shared_ptr<void> guard = tie_.lock();
@@ -42,6 +68,18 @@ void Channel::handleEventSafely() {
         eventCallback_();
         return;
     }
+    if (recvCompleted_) {
+        recvCompleted_ = false;
+        recvCallback_(recvData_, recvResult_);
+    }
+    if (sendCompleted_) {
+        sendCompleted_ = false;
+        sendCallback_(sendResult_);
+    }
+    // The callbacks may have closed the socket.
+    if (events_ == kNoneEvent) {
+        return;
+    }
     if ((revents_ & POLLHUP) && !(revents_ & POLLIN)) {
         // LOG_TRACE<<"handle close";
         if (closeCallback_)
@@ -52,13 +90,22 @@ void Channel::handleEventSafely() {
         if (errorCallback_)
             errorCallback_();
     }
-    if (revents_ & (POLLIN | POLLPRI | POLLRDHUP)) {
+    int revents = revents_;
+    if (edgeTriggered_) {
+        // Every event is reported in edge-triggered mode, drop the disabled
+        // ones.
+        if (!(events_ & kReadEvent))
+            revents &= ~(POLLIN | POLLPRI | POLLRDHUP);
+        if (!(events_ & kWriteEvent))
+            revents &= ~POLLOUT;
+    }
+    if (revents & (POLLIN | POLLPRI | POLLRDHUP)) {
         // LOG_TRACE<<"handle read";
         if (readCallback_)
             readCallback_();
     }
 
-    if (revents_ & POLLOUT) {
+    if (revents & POLLOUT) {
         // LOG_TRACE<<"handle write";
         if (writeCallback_)
             writeCallback_();
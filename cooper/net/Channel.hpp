@@ -1,12 +1,17 @@
 #ifndef net_Channel_hpp
 #define net_Channel_hpp
 
+#include <sys/types.h>
+
 #include <cassert>
 #include <functional>
 #include <memory>
 
 #include "cooper/util/Logger.hpp"
 #include "cooper/util/NonCopyable.hpp"
+
+struct iovec;
+
 namespace cooper {
 class EventLoop;
 /**
@@ -18,6 +23,9 @@ class EventLoop;
 class Channel : NonCopyable {
 public:
     using EventCallback = std::function<void()>;
+    using RecvCallback = std::function<void(const char*, ssize_t)>;
+    using SendPrepareCallback = std::function<int(struct iovec*, int, int*, std::shared_ptr<void>*)>;
+    using SendCallback = std::function<void(ssize_t)>;
     /**
      * @brief Construct a new Channel instance.
      *
@@ -92,6 +100,37 @@ public:
         eventCallback_ = std::move(cb);
     }
 
+    /**
+     * @brief Set the callback of completion-based reads, which are used
+     * instead of read events by a poller that supports them (io_uring).
+     *
+     * @param cb The callback is called with the data read by the poller, with
+     * 0 at the end of the stream, or with -errno. The data is valid only in the
+     * callback.
+     * @note Reading is enabled and disabled as usual, and the read callback is
+     * still called on read events if the poller runs short of buffers.
+     */
+    void setRecvCallback(RecvCallback&& cb) {
+        recvCallback_ = std::move(cb);
+    }
+
+    /**
+     * @brief Set the callbacks of completion-based sends, which are used
+     * instead of write events by a poller that supports them (io_uring).
+     *
+     * @param prepare The callback is called when the writing is enabled, it
+     * fills at most the given number of iovecs with the data to send, sets the
+     * flags of sendmsg() and an object that keeps the data alive until the send
+     * completes, and returns the number of iovecs. A write event is waited for
+     * if it returns 0.
+     * @param cb The callback is called with the number of bytes sent or -errno.
+     * @note The writing stays enabled while a send is in progress.
+     */
+    void setSendCallbacks(SendPrepareCallback&& prepare, SendCallback&& cb) {
+        sendPrepareCallback_ = std::move(prepare);
+        sendCallback_ = std::move(cb);
+    }
+
     /**
      * @brief Return the fd of the socket.
      *
@@ -209,6 +248,27 @@ public:
         return events_ & kReadEvent;
     }
 
+    /**
+     * @brief Register the socket to the poller in edge-triggered mode. Both
+     * read and write events are watched as long as any event is enabled, so
+     * enabling or disabling a single event doesn't cost a system call. The
+     * read callback must read until EAGAIN and the write callback must write
+     * until EAGAIN or nothing is left, otherwise no more event is reported.
+     * @note This method must be called before any event is enabled. It takes
+     * no effect if the event loop doesn't use epoll.
+     */
+    void enableEdgeTriggered();
+
+    /**
+     * @brief Check whether the socket is registered in edge-triggered mode.
+     *
+     * @return true
+     * @return false
+     */
+    bool isEdgeTriggered() const {
+        return edgeTriggered_;
+    }
+
     /**
      * @brief Set and update the events enabled.
      *
@@ -240,9 +300,11 @@ public:
 private:
     friend class EventLoop;
     friend class EpollPoller;
+    friend class IoUringPoller;
     friend class KQueue;
     friend class PollPoller;
     void update();
+    int pollEvents() const;
     void handleEvent();
     void handleEventSafely();
     int setRevents(int revt) {
@@ -262,6 +324,9 @@ private:
     int revents_;
     int index_;
     bool addedToLoop_{false};
+    bool edgeTriggered_{false};
+    // Whether the channel is registered in edge-triggered mode.
+    bool edgeRegistered_{false};
     EventCallback readCallback_;
     EventCallback writeCallback_;
     EventCallback errorCallback_;
@@ -269,6 +334,16 @@ private:
     EventCallback eventCallback_;
     std::weak_ptr<void> tie_;
     bool tied_;
+    RecvCallback recvCallback_;
+    SendPrepareCallback sendPrepareCallback_;
+    SendCallback sendCallback_;
+    // The results of the completion-based reads and sends, set by the poller
+    // and passed to the callbacks when the events are handled.
+    bool recvCompleted_{false};
+    const char* recvData_{nullptr};
+    ssize_t recvResult_{0};
+    bool sendCompleted_{false};
+    ssize_t sendResult_{0};
 };
 }  // namespace cooper
 
@@ -5,6 +5,7 @@
 #include <sys/epoll.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 
@@ -25,6 +26,8 @@ namespace {
 const int kNew = -1;
 const int kAdded = 1;
 const int kDeleted = 2;
+// Added, and an EPOLL_CTL_MOD is pending.
+const int kModPending = 3;
 }  // namespace
 
 EpollPoller::EpollPoller(EventLoop* loop)
@@ -34,6 +37,7 @@ EpollPoller::~EpollPoller() {
     close(epollfd_);
 }
 void EpollPoller::poll(int timeoutMs, ChannelList* activeChannels) {
+    flushPendingChannels();
     int numEvents = ::epoll_wait(epollfd_, &*events_.begin(), static_cast<int>(events_.size()), timeoutMs);
     int savedErrno = errno;
     // Timestamp now(Timestamp::now());
@@ -98,14 +102,48 @@ void EpollPoller::updateChannel(Channel* channel) {
         assert(channels_.find(fd) != channels_.end());
         assert(channels_[fd] == channel);
 #endif
-        assert(index == kAdded);
+        assert(index == kAdded || index == kModPending);
         if (channel->isNoneEvent()) {
+            if (index == kModPending) {
+                removePendingChannel(channel);
+            }
             update(EPOLL_CTL_DEL, channel);
             channel->setIndex(kDeleted);
+        } else if (index == kAdded) {
+            channel->setIndex(kModPending);
+            pendingChannels_.push_back(channel);
+        } else {
+            // Coalesced into the pending modification.
+            savedSyscalls_.store(savedSyscalls_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+    }
+}
+void EpollPoller::flushPendingChannels() {
+    size_t saved = 0;
+    for (auto channel : pendingChannels_) {
+        assert(channel->index() == kModPending);
+        channel->setIndex(kAdded);
+        int fd = channel->fd();
+        assert(static_cast<size_t>(fd) < registeredEvents_.size());
+        if (registeredEvents_[fd] == channel->pollEvents()) {
+            // The changes cancelled each other out.
+            ++saved;
         } else {
             update(EPOLL_CTL_MOD, channel);
         }
     }
+    pendingChannels_.clear();
+    if (saved > 0) {
+        savedSyscalls_.store(savedSyscalls_.load(std::memory_order_relaxed) + saved, std::memory_order_relaxed);
+    }
+}
+void EpollPoller::removePendingChannel(Channel* channel) {
+    auto it = std::find(pendingChannels_.begin(), pendingChannels_.end(), channel);
+    assert(it != pendingChannels_.end());
+    *it = pendingChannels_.back();
+    pendingChannels_.pop_back();
+    // The deferred modification is superseded.
+    savedSyscalls_.store(savedSyscalls_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
 }
 void EpollPoller::removeChannel(Channel* channel) {
     EpollPoller::assertInLoopThread();
@@ -119,8 +157,11 @@ void EpollPoller::removeChannel(Channel* channel) {
 #endif
     assert(channel->isNoneEvent());
     int index = channel->index();
-    assert(index == kAdded || index == kDeleted);
-    if (index == kAdded) {
+    assert(index == kAdded || index == kDeleted || index == kModPending);
+    if (index == kModPending) {
+        removePendingChannel(channel);
+    }
+    if (index == kAdded || index == kModPending) {
         update(EPOLL_CTL_DEL, channel);
     }
     channel->setIndex(kNew);
@@ -128,9 +169,15 @@ void EpollPoller::removeChannel(Channel* channel) {
 void EpollPoller::update(int operation, Channel* channel) {
     struct epoll_event event;
     memset(&event, 0, sizeof(event));
-    event.events = channel->events();
+    event.events = channel->pollEvents();
     event.data.ptr = channel;
     int fd = channel->fd();
+    if (operation != EPOLL_CTL_DEL) {
+        if (static_cast<size_t>(fd) >= registeredEvents_.size()) {
+            registeredEvents_.resize(std::max(static_cast<size_t>(fd) + 1, registeredEvents_.size() * 2));
+        }
+        registeredEvents_[fd] = event.events;
+    }
     if (::epoll_ctl(epollfd_, operation, fd, &event) < 0) {
         if (operation == EPOLL_CTL_DEL) {
             // LOG_SYSERR << "epoll_ctl op =" << operationToString(operation) <<
@@ -1,6 +1,7 @@
 #ifndef net_EpollPoller_hpp
 #define net_EpollPoller_hpp
 
+#include <atomic>
 #include <map>
 #include <memory>
 
@@ -18,13 +19,25 @@ public:
     virtual void poll(int timeoutMs, ChannelList* activeChannels) override;
     virtual void updateChannel(Channel* channel) override;
     virtual void removeChannel(Channel* channel) override;
+    virtual size_t savedSyscalls() const override {
+        return savedSyscalls_.load(std::memory_order_relaxed);
+    }
 
 private:
     static const int kInitEventListSize = 16;
 
     int epollfd_;
     EventList events_;
+    // Channels whose EPOLL_CTL_MOD is deferred to the next poll() call, so
+    // that repeated interest changes in one loop iteration cost at most one
+    // system call.
+    std::vector<Channel*> pendingChannels_;
+    // The events registered in epoll, indexed by fd.
+    std::vector<int> registeredEvents_;
+    std::atomic<size_t> savedSyscalls_{0};
     void update(int operation, Channel* channel);
+    void flushPendingChannels();
+    void removePendingChannel(Channel* channel);
 #ifndef NDEBUG
     using ChannelMap = std::map<int, Channel*>;
     ChannelMap channels_;
@@ -28,18 +28,21 @@ int createEventfd() {
 }
 
 const int kPollTimeMs = 10000;
+// How many queued functions run between two checks of the time budget.
+const size_t kTaskTimeCheckInterval = 16;
 thread_local EventLoop* t_loopInThisThread = nullptr;
 
-EventLoop::EventLoop()
+EventLoop::EventLoop(PollerType pollerType)
     : looping_(false),
       threadId_(std::this_thread::get_id()),
       quit_(false),
-      poller_(Poller::newPoller(this)),
+      poller_(Poller::newPoller(this, pollerType)),
       currentActiveChannel_(nullptr),
       eventHandling_(false),
       timerQueue_(new TimerQueue(this)),
       wakeupFd_(createEventfd()),
       wakeupChannelPtr_(new Channel(this, wakeupFd_)),
+      pthreadId_(pthread_self()),
       threadLocalLoopPtr_(&t_loopInThisThread) {
     if (t_loopInThisThread) {
         LOG_FATAL << "There is already an EventLoop in this thread";
@@ -75,6 +78,38 @@ EventLoop::~EventLoop() {
     t_loopInThisThread = nullptr;
     close(wakeupFd_);
 }
+PollerType EventLoop::pollerType() const {
+    return poller_->type();
+}
+size_t EventLoop::savedPollerSyscalls() const {
+    return poller_->savedSyscalls();
+}
+RunQueueStats EventLoop::runQueueStats() const {
+    RunQueueStats stats;
+    stats.queueDepth = queueDepth_.load(std::memory_order_relaxed);
+    stats.maxQueueDepth = maxQueueDepth_.load(std::memory_order_relaxed);
+    stats.iterationTime = std::chrono::microseconds(iterationTimeUs_.load(std::memory_order_relaxed));
+    stats.maxIterationTime = std::chrono::microseconds(maxIterationTimeUs_.load(std::memory_order_relaxed));
+    stats.budgetExhausted = budgetExhausted_.load(std::memory_order_relaxed);
+    return stats;
+}
+EventLoopStats EventLoop::stats() const {
+    EventLoopStats stats;
+    stats.iterations = iterations_.load(std::memory_order_relaxed);
+    stats.events = events_.load(std::memory_order_relaxed);
+    stats.pollTimeUs = pollTimeUs_.snapshot();
+    stats.handleTimeUs = handleTimeUs_.snapshot();
+    stats.eventsPerWakeup = eventsPerWakeup_.snapshot();
+    stats.timerTimeUs = timerQueue_->callbackTimeUs().snapshot();
+    stats.runQueue = runQueueStats();
+    uint64_t slowest = slowestEvent_.load(std::memory_order_relaxed);
+    if (slowest != 0) {
+        stats.slowestEventTime = std::chrono::microseconds(slowest >> 32);
+        stats.slowestEventFd = static_cast<int>(static_cast<uint32_t>(slowest));
+    }
+    stats.bufferPool = bufferPool_.stats();
+    return stats;
+}
 EventLoop* EventLoop::getEventLoopOfCurrentThread() {
     return t_loopInThisThread;
 }
@@ -131,20 +166,64 @@ void EventLoop::loop() {
         auto loopFlagCleaner = makeScopeExit([this]() {
             looping_.store(false, std::memory_order_release);
         });
+        std::chrono::steady_clock::time_point lastActiveTime;
+        spinning_ = false;
+        hasPendingFuncs_ = false;
+        // Functions queued after the last run of a spinning loop didn't write
+        // the eventfd.
+        wakeupPending_.store(false, std::memory_order_release);
+        if (!funcs_.empty()) {
+            wakeup();
+        }
+        auto pollStart = std::chrono::steady_clock::now();
         while (!quit_.load(std::memory_order_acquire)) {
             activeChannels_.clear();
-            poller_->poll(kPollTimeMs, &activeChannels_);
+            setActivity(LoopActivity::kPolling, 0);
+            poller_->poll(spinning_ || hasPendingFuncs_ ? 0 : kPollTimeMs, &activeChannels_);
+            auto iterationStart = std::chrono::steady_clock::now();
+            pollTimeUs_.add(std::chrono::duration_cast<std::chrono::microseconds>(iterationStart - pollStart).count());
+            eventsPerWakeup_.add(activeChannels_.size());
+            iterations_.store(iterations_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            events_.store(events_.load(std::memory_order_relaxed) + activeChannels_.size(),
+                          std::memory_order_relaxed);
+            int64_t spinDurationUs = spinDurationUs_.load(std::memory_order_relaxed);
+            if (spinDurationUs > 0) {
+                // Timers and queued functions wake the loop up through their
+                // fds as well, so any active channel counts as activity.
+                if (!activeChannels_.empty() || !spinning_) {
+                    lastActiveTime = iterationStart;
+                }
+                spinning_ = iterationStart - lastActiveTime < std::chrono::microseconds(spinDurationUs);
+            } else {
+                spinning_ = false;
+            }
             // TODO sort channel by priority
             // std::cout<<"after ->poll()"<<std::endl;
             eventHandling_ = true;
+            auto eventStart = iterationStart;
             for (auto it = activeChannels_.begin(); it != activeChannels_.end(); ++it) {
                 currentActiveChannel_ = *it;
+                int fd = currentActiveChannel_->fd();
+                setActivity(LoopActivity::kHandlingEvent, fd);
                 currentActiveChannel_->handleEvent();
+                auto eventEnd = std::chrono::steady_clock::now();
+                recordEventTime(fd,
+                                std::chrono::duration_cast<std::chrono::microseconds>(eventEnd - eventStart).count());
+                eventStart = eventEnd;
             }
             currentActiveChannel_ = nullptr;
             eventHandling_ = false;
+            handleTimeUs_.add(
+                std::chrono::duration_cast<std::chrono::microseconds>(eventStart - iterationStart).count());
             // std::cout << "looping" << endl;
             doRunInLoopFuncs();
+            pollStart = std::chrono::steady_clock::now();
+            int64_t iterationTimeUs =
+                std::chrono::duration_cast<std::chrono::microseconds>(pollStart - iterationStart).count();
+            iterationTimeUs_.store(iterationTimeUs, std::memory_order_relaxed);
+            if (iterationTimeUs > maxIterationTimeUs_.load(std::memory_order_relaxed)) {
+                maxIterationTimeUs_.store(iterationTimeUs, std::memory_order_relaxed);
+            }
         }
         // loopFlagCleaner clears the loop flag here
     } catch (std::exception& e) {
@@ -176,13 +255,13 @@ void EventLoop::abortNotInLoopThread() {
 void EventLoop::queueInLoop(const Func& cb) {
     funcs_.enqueue(cb);
     if (!isInLoopThread() || !looping_.load(std::memory_order_acquire)) {
-        wakeup();
+        wakeupIfNeeded();
     }
 }
 void EventLoop::queueInLoop(Func&& cb) {
     funcs_.enqueue(std::move(cb));
     if (!isInLoopThread() || !looping_.load(std::memory_order_acquire)) {
-        wakeup();
+        wakeupIfNeeded();
     }
 }
 
@@ -230,12 +309,45 @@ void EventLoop::doRunInLoopFuncs() {
         // TODO: The following is exception-unsafe. If one  of the funcs throws,
         // the remaining ones will not get run. The simplest fix is to catch any
         // exceptions and rethrow them later, but somehow that seems fishy...
-        while (!funcs_.empty()) {
-            Func func;
-            while (funcs_.dequeue(func)) {
-                func();
+        //
+        // Producers skip the eventfd write while a wakeup is pending, so the
+        // flag must be cleared before draining to not miss the functions
+        // queued after the drain. A spinning loop polls again without
+        // blocking, so the flag is left set to suppress the writes.
+        if (!spinning_) {
+            wakeupPending_.exchange(false, std::memory_order_acq_rel);
+        }
+        size_t depth = funcs_.size();
+        queueDepth_.store(depth, std::memory_order_relaxed);
+        if (depth > maxQueueDepth_.load(std::memory_order_relaxed)) {
+            maxQueueDepth_.store(depth, std::memory_order_relaxed);
+        }
+        size_t maxTasks = maxTasksPerIteration_.load(std::memory_order_relaxed);
+        int64_t maxTimeUs = maxTaskTimeUs_.load(std::memory_order_relaxed);
+        auto deadline = std::chrono::steady_clock::time_point::max();
+        if (maxTimeUs > 0) {
+            deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(maxTimeUs);
+        }
+        hasPendingFuncs_ = false;
+        size_t count = 0;
+        Task task;
+        while (funcs_.dequeue(task)) {
+            setActivity(LoopActivity::kRunningFunction, reinterpret_cast<uintptr_t>(&task.targetType()));
+            task();
+            ++count;
+            if ((maxTasks > 0 && count >= maxTasks) ||
+                (maxTimeUs > 0 && count % kTaskTimeCheckInterval == 0 &&
+                 std::chrono::steady_clock::now() >= deadline)) {
+                hasPendingFuncs_ = !funcs_.empty();
+                break;
             }
         }
+        if (hasPendingFuncs_) {
+            // The loop polls without blocking to run the rest, so no wakeup is
+            // needed until the next run.
+            wakeupPending_.store(true, std::memory_order_release);
+            budgetExhausted_.fetch_add(1, std::memory_order_relaxed);
+        }
     }
 }
 void EventLoop::wakeup() {
@@ -245,6 +357,19 @@ void EventLoop::wakeup() {
     int ret = write(wakeupFd_, &tmp, sizeof(tmp));
     (void)ret;
 }
+void EventLoop::wakeupIfNeeded() {
+    if (wakeupPending_.exchange(true, std::memory_order_acq_rel)) {
+        wakeupsSuppressed_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    wakeupsIssued_.fetch_add(1, std::memory_order_relaxed);
+    wakeup();
+}
+void EventLoop::recordEventTime(int fd, int64_t us) {
+    if (static_cast<uint64_t>(us) > (slowestEvent_.load(std::memory_order_relaxed) >> 32)) {
+        slowestEvent_.store((static_cast<uint64_t>(us) << 32) | static_cast<uint32_t>(fd), std::memory_order_relaxed);
+    }
+}
 void EventLoop::wakeupRead() {
     ssize_t ret = 0;
     uint64_t tmp;
@@ -271,6 +396,9 @@ void EventLoop::moveToCurrentThread() {
     t_loopInThisThread = this;
     threadLocalLoopPtr_ = &t_loopInThisThread;
     threadId_ = std::this_thread::get_id();
+    pthreadId_ = pthread_self();
+    // The nodes of the write queues are pooled in the thread of the loop.
+    bufferPool_.moveToCurrentThread();
 }
 
 void EventLoop::runOnQuit(Func&& cb) {
@@ -1,6 +1,8 @@
 #ifndef net_EventLoop_hpp
 #define net_EventLoop_hpp
 
+#include <pthread.h>
+
 #include <atomic>
 #include <chrono>
 #include <functional>
@@ -11,9 +13,12 @@
 #include <thread>
 #include <vector>
 
+#include "cooper/util/BufferPool.hpp"
 #include "cooper/util/Date.hpp"
+#include "cooper/util/Histogram.hpp"
 #include "cooper/util/LockFreeQueue.hpp"
 #include "cooper/util/NonCopyable.hpp"
+#include "cooper/util/TaskQueue.hpp"
 
 namespace cooper {
 class Poller;
@@ -24,6 +29,87 @@ using Func = std::function<void()>;
 using TimerId = uint64_t;
 enum { InvalidTimerId = 0 };
 
+/**
+ * @brief The I/O multiplexing mechanism used by an event loop.
+ *
+ */
+enum class PollerType {
+    // epoll(7), always available.
+    kEpoll,
+    // io_uring(7), falls back to epoll if the kernel doesn't support it.
+    kIoUring
+};
+
+/**
+ * @brief What the thread of an event loop is doing.
+ *
+ */
+enum class LoopActivity : uint8_t {
+    // Waiting in the poller.
+    kPolling,
+    // Handling the events of a channel, the ID is the fd.
+    kHandlingEvent,
+    // Running a queued function, the ID is the address of the std::type_info
+    // of the function.
+    kRunningFunction,
+    // Running a timer callback, the ID is the TimerId.
+    kRunningTimer
+};
+
+/**
+ * @brief A sample of the heartbeat of an event loop. The count increases every
+ * time the event loop starts a new activity, so a count that stays the same
+ * means the event loop is stuck in the activity.
+ *
+ */
+struct LoopHeartbeat {
+    uint64_t count{0};
+    LoopActivity activity{LoopActivity::kPolling};
+    uint64_t id{0};
+};
+
+/**
+ * @brief The statistics of the functions queued to an event loop.
+ *
+ */
+struct RunQueueStats {
+    // The number of functions in the queue when the last run of them started.
+    size_t queueDepth{0};
+    size_t maxQueueDepth{0};
+    // The time from the return of the poller to the end of the queued
+    // functions in the last loop iteration.
+    std::chrono::microseconds iterationTime{0};
+    std::chrono::microseconds maxIterationTime{0};
+    // The number of loop iterations that left functions to the next one
+    // because of the task budget.
+    uint64_t budgetExhausted{0};
+};
+
+/**
+ * @brief The statistics of an event loop.
+ *
+ */
+struct EventLoopStats {
+    uint64_t iterations{0};
+    // The number of active channels handled.
+    uint64_t events{0};
+    // The time in microseconds spent waiting in the poller per iteration.
+    Log2Histogram::Buckets pollTimeUs{};
+    // The time in microseconds spent handling active channels per iteration.
+    Log2Histogram::Buckets handleTimeUs{};
+    // The number of active channels per iteration.
+    Log2Histogram::Buckets eventsPerWakeup{};
+    // The time in microseconds of every timer callback.
+    Log2Histogram::Buckets timerTimeUs{};
+    RunQueueStats runQueue;
+    // The longest time spent in Channel::handleEvent() and the fd of that
+    // channel.
+    std::chrono::microseconds slowestEventTime{0};
+    int slowestEventFd{-1};
+    // The allocations of the buffer pool of the event loop, see BufferPool.
+    BufferPoolStats bufferPool;
+};
+
 /**
  * @brief As the name implies, this class represents an event loop that runs in
  * a perticular thread. The event loop can handle network I/O events and timers
@@ -35,7 +121,12 @@ enum { InvalidTimerId = 0 };
  */
 class EventLoop : NonCopyable {
 public:
-    EventLoop();
+    /**
+     * @brief Construct a new event loop.
+     *
+     * @param pollerType The I/O multiplexing mechanism of the event loop.
+     */
+    explicit EventLoop(PollerType pollerType = PollerType::kEpoll);
     ~EventLoop();
 
     /**
@@ -116,6 +207,16 @@ public:
      */
     void queueInLoop(const Func& f);
     void queueInLoop(Func&& f);
+    template <typename Functor,
+              typename = typename std::enable_if<!std::is_same<typename std::decay<Functor>::type, Func>::value>::type>
+    void queueInLoop(Functor&& f) {
+        // The callable is stored in the queue directly, without being wrapped
+        // into a std::function.
+        funcs_.enqueue(std::forward<Functor>(f));
+        if (!isInLoopThread() || !looping_.load(std::memory_order_acquire)) {
+            wakeupIfNeeded();
+        }
+    }
 
     /**
      * @brief Run a function at a time point.
@@ -227,6 +328,149 @@ public:
         index_ = index;
     }
 
+    /**
+     * @brief Return the NUMA node the thread of the event loop is pinned to,
+     * -1 if the thread is not pinned to a single node.
+     *
+     * @return int
+     */
+    int numaNode() const {
+        return numaNode_;
+    }
+
+    /**
+     * @brief Set the NUMA node of the event loop. This method is usually used
+     * internally.
+     *
+     * @param node
+     */
+    void setNumaNode(int node) {
+        numaNode_ = node;
+    }
+
+    /**
+     * @brief Enable the spin mode. In this mode, the event loop polls without
+     * blocking until no I/O event occurs in the given period of time, and only
+     * then falls back to a blocking wait. This trades CPU time for the latency
+     * of waking up a blocked thread, so it should only be used on loops that
+     * run on dedicated cores.
+     *
+     * @param duration The period of time to spin after the last I/O event, 0
+     * disables the spin mode, which is the default.
+     */
+    void setSpinDuration(const std::chrono::microseconds& duration) {
+        spinDurationUs_.store(duration.count(), std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Return the period of time the event loop spins after the last I/O
+     * event.
+     *
+     * @return std::chrono::microseconds
+     */
+    std::chrono::microseconds spinDuration() const {
+        return std::chrono::microseconds(spinDurationUs_.load(std::memory_order_relaxed));
+    }
+
+    /**
+     * @brief Limit the queued functions run in one loop iteration, the rest of
+     * them are carried to the next iteration after the poller is checked
+     * without blocking. This keeps the latency of I/O events bounded when
+     * functions are queued faster than the loop runs them.
+     *
+     * @param maxTasks The maximum number of functions per iteration, 0 means
+     * unlimited, which is the default.
+     * @param maxTime The maximum time spent on functions per iteration, 0
+     * means unlimited, which is the default.
+     */
+    void setTaskBudget(size_t maxTasks, const std::chrono::microseconds& maxTime = std::chrono::microseconds(0)) {
+        maxTasksPerIteration_.store(maxTasks, std::memory_order_relaxed);
+        maxTaskTimeUs_.store(maxTime.count(), std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Return the statistics of the queued functions.
+     *
+     * @return RunQueueStats
+     */
+    RunQueueStats runQueueStats() const;
+
+    /**
+     * @brief Return the statistics of the event loop. This method can be
+     * called in any thread, the counters are updated by the thread of the
+     * event loop without locking, so they are not a consistent snapshot.
+     *
+     * @return EventLoopStats
+     */
+    EventLoopStats stats() const;
+
+    /**
+     * @brief Record the activity the event loop starts. This method is usually
+     * used internally.
+     *
+     * @param activity
+     * @param id
+     */
+    void setActivity(LoopActivity activity, uint64_t id) {
+        activityId_.store(id, std::memory_order_relaxed);
+        activity_.store(activity, std::memory_order_relaxed);
+        // Only the thread of the event loop writes the heartbeat.
+        heartbeat_.store(heartbeat_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Return the heartbeat of the event loop, it can be called in any
+     * thread, see LoopWatchdog.
+     *
+     * @return LoopHeartbeat
+     */
+    LoopHeartbeat heartbeat() const {
+        LoopHeartbeat beat;
+        beat.count = heartbeat_.load(std::memory_order_acquire);
+        beat.activity = activity_.load(std::memory_order_relaxed);
+        beat.id = activityId_.load(std::memory_order_relaxed);
+        // The activity may belong to a newer count, which is only checked when
+        // the count doesn't change, so return the newest one.
+        beat.count = heartbeat_.load(std::memory_order_acquire);
+        return beat;
+    }
+
+    /**
+     * @brief Return the I/O multiplexing mechanism actually used by the event
+     * loop, which is kEpoll if kIoUring was requested but is unavailable.
+     *
+     * @return PollerType
+     */
+    PollerType pollerType() const;
+
+    /**
+     * @brief Return the number of system calls the poller has saved by
+     * coalescing the interest changes of channels in one loop iteration.
+     *
+     * @return size_t
+     */
+    size_t savedPollerSyscalls() const;
+
+    /**
+     * @brief Return the number of eventfd writes issued to wake up the event
+     * loop for queued functions.
+     *
+     * @return uint64_t
+     */
+    uint64_t wakeupsIssued() const {
+        return wakeupsIssued_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Return the number of eventfd writes suppressed because a wakeup
+     * was already pending or the event loop was spinning.
+     *
+     * @return uint64_t
+     */
+    uint64_t wakeupsSuppressed() const {
+        return wakeupsSuppressed_.load(std::memory_order_relaxed);
+    }
+
     /**
      * @brief Return true if the event loop is running.
      *
@@ -257,9 +501,15 @@ public:
     void runOnQuit(const Func& cb);
 
 private:
+    friend class LoopWatchdog;
     void abortNotInLoopThread();
     void wakeup();
+    void wakeupIfNeeded();
     void wakeupRead();
+    void recordEventTime(int fd, int64_t us);
+    // Declared first so that it is destroyed last, after everything that may
+    // release memory to it.
+    BufferPool bufferPool_;
     std::atomic<bool> looping_;
     std::thread::id threadId_;
     std::atomic<bool> quit_;
@@ -269,7 +519,7 @@ private:
     Channel* currentActiveChannel_;
 
     bool eventHandling_;
-    MpscQueue<Func> funcs_;
+    TaskQueue funcs_;
     std::unique_ptr<TimerQueue> timerQueue_;
     MpscQueue<Func> funcsOnQuit_;
     bool callingFuncs_{false};
@@ -279,6 +529,35 @@ private:
     void doRunInLoopFuncs();
 
     size_t index_{std::numeric_limits<size_t>::max()};
+    std::atomic<int64_t> spinDurationUs_{0};
+    bool spinning_{false};
+    // True from the first wakeup after the queue is drained until the next
+    // drain, and all the time while the loop is spinning.
+    std::atomic<bool> wakeupPending_{false};
+    std::atomic<uint64_t> wakeupsIssued_{0};
+    std::atomic<uint64_t> wakeupsSuppressed_{0};
+    std::atomic<size_t> maxTasksPerIteration_{0};
+    std::atomic<int64_t> maxTaskTimeUs_{0};
+    // True if the last run of queued functions left some to the next one.
+    bool hasPendingFuncs_{false};
+    std::atomic<size_t> queueDepth_{0};
+    std::atomic<size_t> maxQueueDepth_{0};
+    std::atomic<int64_t> iterationTimeUs_{0};
+    std::atomic<int64_t> maxIterationTimeUs_{0};
+    std::atomic<uint64_t> budgetExhausted_{0};
+    std::atomic<uint64_t> iterations_{0};
+    std::atomic<uint64_t> events_{0};
+    Log2Histogram pollTimeUs_;
+    Log2Histogram handleTimeUs_;
+    Log2Histogram eventsPerWakeup_;
+    // The time in microseconds in the high 32 bits and the fd in the low 32
+    // bits, so that they are updated together.
+    std::atomic<uint64_t> slowestEvent_{0};
+    std::atomic<uint64_t> heartbeat_{0};
+    std::atomic<LoopActivity> activity_{LoopActivity::kPolling};
+    std::atomic<uint64_t> activityId_{0};
+    pthread_t pthreadId_;
+    int numaNode_{-1};
     EventLoop** threadLocalLoopPtr_;
 };
 
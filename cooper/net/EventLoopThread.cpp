@@ -3,11 +3,16 @@
 #include <sys/prctl.h>
 
 #include "cooper/net/EventLoopThread.hpp"
+#include "cooper/util/CpuAffinity.hpp"
 #include "cooper/util/Logger.hpp"
 
 using namespace cooper;
-EventLoopThread::EventLoopThread(const std::string& threadName)
-    : loop_(nullptr), loopThreadName_(threadName), thread_([this]() {
+EventLoopThread::EventLoopThread(const std::string& threadName, PollerType pollerType, std::vector<int> cpus)
+    : loop_(nullptr),
+      loopThreadName_(threadName),
+      pollerType_(pollerType),
+      cpus_(std::move(cpus)),
+      thread_([this]() {
           loopFuncs();
       }) {
     auto f = promiseForLoopPointer_.get_future();
@@ -37,7 +42,20 @@ void EventLoopThread::loopFuncs() {
 #ifdef __linux__
     ::prctl(PR_SET_NAME, loopThreadName_.c_str());
 #endif
-    thread_local static std::shared_ptr<EventLoop> loop = std::make_shared<EventLoop>();
+    int numaNode = -1;
+    if (!cpus_.empty() && utils::setCurrentThreadAffinity(cpus_)) {
+        // Pin before creating the event loop, so that its memory is allocated
+        // on the local node.
+        numaNode = utils::numaNodeOfCpu(cpus_[0]);
+        for (int cpu : cpus_) {
+            if (utils::numaNodeOfCpu(cpu) != numaNode) {
+                numaNode = -1;
+                break;
+            }
+        }
+    }
+    thread_local static std::shared_ptr<EventLoop> loop = std::make_shared<EventLoop>(pollerType_);
+    loop->setNumaNode(numaNode);
     loop->queueInLoop([this]() {
         promiseForLoop_.set_value(1);
     });
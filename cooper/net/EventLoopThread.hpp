@@ -6,6 +6,7 @@
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 #include "cooper/net/EventLoop.hpp"
 #include "cooper/util/NonCopyable.hpp"
@@ -17,7 +18,17 @@ namespace cooper {
  */
 class EventLoopThread : NonCopyable {
 public:
-    explicit EventLoopThread(const std::string& threadName = "EventLoopThread");
+    /**
+     * @brief Construct a new event loop thread.
+     *
+     * @param threadName The name of the thread.
+     * @param pollerType The I/O multiplexing mechanism of the event loop.
+     * @param cpus The CPUs the thread is pinned to before the event loop is
+     * created, the thread is not pinned if empty.
+     */
+    explicit EventLoopThread(const std::string& threadName = "EventLoopThread",
+                             PollerType pollerType = PollerType::kEpoll,
+                             std::vector<int> cpus = {});
     ~EventLoopThread();
 
     /**
@@ -48,6 +59,8 @@ private:
     std::mutex loopMutex_;
 
     std::string loopThreadName_;
+    PollerType pollerType_;
+    std::vector<int> cpus_;
     void loopFuncs();
     std::promise<std::shared_ptr<EventLoop>> promiseForLoopPointer_;
     std::promise<int> promiseForRun_;
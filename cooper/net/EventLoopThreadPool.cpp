@@ -2,9 +2,11 @@
 
 using namespace cooper;
 
-EventLoopThreadPool::EventLoopThreadPool(size_t threadNum, const std::string& name) : loopIndex_(0) {
+EventLoopThreadPool::EventLoopThreadPool(size_t threadNum, const std::string& name, PollerType pollerType,
+                                         const CpuAffinityPolicy& affinity)
+    : loopIndex_(0) {
     for (size_t i = 0; i < threadNum; ++i) {
-        loopThreadVector_.emplace_back(std::make_shared<EventLoopThread>(name));
+        loopThreadVector_.emplace_back(std::make_shared<EventLoopThread>(name, pollerType, affinity.cpusForThread(i)));
     }
 }
 void EventLoopThreadPool::start() {
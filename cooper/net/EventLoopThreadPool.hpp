@@ -6,6 +6,7 @@
 #include <vector>
 
 #include "cooper/net/EventLoopThread.hpp"
+#include "cooper/util/CpuAffinity.hpp"
 
 namespace cooper {
 /**
@@ -21,8 +22,13 @@ public:
      *
      * @param threadNum The number of threads
      * @param name The name of the EventLoopThreadPool object.
+     * @param pollerType The I/O multiplexing mechanism of the event loops.
+     * @param affinity The policy to place the threads on CPUs.
      */
-    EventLoopThreadPool(size_t threadNum, const std::string& name = "EventLoopThreadPool");
+    EventLoopThreadPool(size_t threadNum,
+                        const std::string& name = "EventLoopThreadPool",
+                        PollerType pollerType = PollerType::kEpoll,
+                        const CpuAffinityPolicy& affinity = CpuAffinityPolicy());
 
     /**
      * @brief Run all event loops in the pool.
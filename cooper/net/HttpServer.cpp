@@ -25,6 +25,8 @@ void HttpServer::start(int loopNum) {
         }
     });
     server_->setIoLoopNum(loopNum);
+    // The header, the body and the file of a response are written together.
+    server_->setAutoCork(true);
     server_->kickoffIdleConnections(keepAliveTimeout_);
     server_->start();
     loopThread_.wait();
@@ -34,6 +36,10 @@ void HttpServer::stop() {
     server_->stop();
 }
 
+void HttpServer::enableWatchdog(const std::chrono::milliseconds& threshold, bool dumpBacktrace) {
+    server_->enableWatchdog(threshold, dumpBacktrace);
+}
+
 void HttpServer::setKeepAliveTimeout(size_t timeout) {
     keepAliveTimeout_ = timeout;
 }
@@ -213,10 +219,13 @@ bool HttpServer::sendResponse(const cooper::TcpConnectionPtr& conn, cooper::Http
         res += header.first + ": " + header.second + "\r\n";
     }
     res += "\r\n";
-    if (!response.contentWriter_) {
-        res += response.body_;
+    if (!response.contentWriter_ && !response.body_.empty()) {
+        // The header and the body are sent in one writev() without being
+        // concatenated.
+        conn->send(std::vector<BufferSlice>{{res.data(), res.size()}, {response.body_.data(), response.body_.size()}});
+    } else {
+        conn->send(res);
     }
-    conn->send(res);
     if (response.contentWriter_) {
         response.contentWriter_->write(conn);
     }
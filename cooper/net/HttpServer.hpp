@@ -62,6 +62,13 @@ public:
      */
     bool removeMountPoint(const std::string& mountPoint);
 
+    /**
+     * @brief enable the watchdog of event loops, see TcpServer::enableWatchdog()
+     * @param threshold
+     * @param dumpBacktrace
+     */
+    void enableWatchdog(const std::chrono::milliseconds& threshold, bool dumpBacktrace = false);
+
     /**
      * @brief set file auth callback
      * @param cb
@@ -0,0 +1,542 @@
+#include "IoUringPoller.hpp"
+
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+
+#include "cooper/net/Channel.hpp"
+#include "cooper/util/Logger.hpp"
+
+namespace cooper {
+
+namespace {
+const int kNew = -1;
+// The user_data of the requests whose completions are ignored, e.g.
+// POLL_REMOVE and PROVIDE_BUFFERS.
+const uint64_t kCancelUserData = std::numeric_limits<uint64_t>::max();
+
+int ioUringSetup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, const void* arg, size_t argSize) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize));
+}
+}  // namespace
+
+IoUringPoller::IoUringPoller(EventLoop* loop) : Poller(loop) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = ioUringSetup(kRingEntries, &params);
+    if (fd < 0) {
+        LOG_SYSERR << "io_uring_setup";
+        return;
+    }
+    // A single mmap for both rings and waiting with a timeout in
+    // io_uring_enter() are required, both are available since Linux 5.11.
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+        LOG_WARN << "io_uring of the running kernel lacks required features";
+        ::close(fd);
+        return;
+    }
+    ringSize_ = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                         params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    ringPtr_ = ::mmap(nullptr, ringSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ringPtr_ == MAP_FAILED) {
+        LOG_SYSERR << "mmap io_uring rings";
+        ringPtr_ = nullptr;
+        ::close(fd);
+        return;
+    }
+    sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = ::mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        LOG_SYSERR << "mmap io_uring sqes";
+        ::munmap(ringPtr_, ringSize_);
+        ringPtr_ = nullptr;
+        ::close(fd);
+        return;
+    }
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    char* ring = static_cast<char*>(ringPtr_);
+    sqHead_ = reinterpret_cast<unsigned*>(ring + params.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned*>(ring + params.sq_off.tail);
+    sqArray_ = reinterpret_cast<unsigned*>(ring + params.sq_off.array);
+    sqMask_ = *reinterpret_cast<unsigned*>(ring + params.sq_off.ring_mask);
+    sqEntries_ = params.sq_entries;
+    sqLocalTail_ = *sqTail_;
+    cqHead_ = reinterpret_cast<unsigned*>(ring + params.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned*>(ring + params.cq_off.tail);
+    cqMask_ = *reinterpret_cast<unsigned*>(ring + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(ring + params.cq_off.cqes);
+    ringFd_ = fd;
+}
+
+IoUringPoller::~IoUringPoller() {
+    // Closing the ring tears the requests down asynchronously, the kernel
+    // could still use the buffers and the iovecs after they are freed.
+    if (ringFd_ >= 0) {
+        cancelAllRequests();
+    }
+    if (sqes_) {
+        ::munmap(sqes_, sqesSize_);
+    }
+    if (ringPtr_) {
+        ::munmap(ringPtr_, ringSize_);
+    }
+    if (ringFd_ >= 0) {
+        ::close(ringFd_);
+    }
+}
+
+void IoUringPoller::poll(int timeoutMs, ChannelList* activeChannels) {
+    // The send callbacks of the last iteration have been called, the objects
+    // kept alive for them can go now.
+    releasedKeepAlives_.clear();
+    recycleRecvBuffers();
+    armPendingChannels();
+    submitAndWait(timeoutMs);
+    reapCompletions(activeChannels);
+}
+
+io_uring_sqe* IoUringPoller::getSqe() {
+    unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    if (sqLocalTail_ - head >= sqEntries_) {
+        // The submission queue is full, hand the queued entries over to the
+        // kernel without waiting for anything.
+        submitAndWait(0);
+        head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+        if (sqLocalTail_ - head >= sqEntries_) {
+            LOG_ERROR << "io_uring submission queue overflow";
+            return nullptr;
+        }
+    }
+    unsigned index = sqLocalTail_ & sqMask_;
+    io_uring_sqe* sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray_[index] = index;
+    ++sqLocalTail_;
+    return sqe;
+}
+
+void IoUringPoller::submitAndWait(int timeoutMs) {
+    __atomic_store_n(sqTail_, sqLocalTail_, __ATOMIC_RELEASE);
+    unsigned toSubmit = sqLocalTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    bool hasCompletions = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE) != *cqHead_;
+    int ret;
+    if (timeoutMs == 0 || hasCompletions) {
+        if (toSubmit == 0) {
+            return;
+        }
+        ret = ioUringEnter(ringFd_, toSubmit, 0, 0, nullptr, 0);
+    } else {
+        struct __kernel_timespec ts;
+        io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        if (timeoutMs > 0) {
+            ts.tv_sec = timeoutMs / 1000;
+            ts.tv_nsec = static_cast<long long>(timeoutMs % 1000) * 1000000;
+            arg.ts = reinterpret_cast<uint64_t>(&ts);
+        }
+        ret = ioUringEnter(ringFd_,
+                           toSubmit,
+                           1,
+                           IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                           &arg,
+                           sizeof(arg));
+    }
+    if (ret < 0 && errno != ETIME && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        LOG_SYSERR << "IoUringPoller::poll()";
+    }
+}
+
+void IoUringPoller::reapCompletions(ChannelList* activeChannels) {
+    unsigned head = *cqHead_;
+    unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        const io_uring_cqe& cqe = cqes_[head & cqMask_];
+        if (cqe.user_data == kCancelUserData) {
+            continue;
+        }
+        --requestsInFlight_;
+        size_t slot = static_cast<size_t>(cqe.user_data >> 32);
+        auto kind = static_cast<RequestKind>((cqe.user_data >> 30) & 0x3);
+        uint32_t generation = static_cast<uint32_t>(cqe.user_data) & 0x3fffffff;
+        assert(slot < entries_.size());
+        Entry& entry = entries_[slot];
+        if (kind == kPoll) {
+            if (entry.channel == nullptr || (entry.generation & 0x3fffffff) != generation) {
+                // The poll was cancelled after it had completed.
+                continue;
+            }
+            entry.armedEvents = 0;
+            int revents = cqe.res;
+            if (cqe.res < 0) {
+                // Let the channel handle the failure like an error on the
+                // socket rather than waiting for an event that never comes.
+                LOG_ERROR << "io_uring poll failed on fd " << entry.channel->fd() << ": " << strerror(-cqe.res);
+                revents = POLLERR;
+            }
+            if (revents & POLLIN) {
+                entry.recvFallback = false;
+            }
+            report(slot, revents, activeChannels);
+        } else if (kind == kRecv) {
+            bool hasBuffer = cqe.flags & IORING_CQE_F_BUFFER;
+            uint16_t bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            if (hasBuffer) {
+                // The buffer is given back to the kernel in the next
+                // iteration, after the receive callback has used it.
+                usedRecvBuffers_.push_back(bid);
+            }
+            if (entry.channel == nullptr || (entry.requestGeneration & 0x3fffffff) != generation) {
+                continue;
+            }
+            entry.recvInFlight = false;
+            entry.recvCancelled = false;
+            if (cqe.res == -ENOBUFS) {
+                entry.recvFallback = true;
+            } else if (cqe.res != -ECANCELED) {
+                Channel* channel = entry.channel;
+                channel->recvCompleted_ = true;
+                channel->recvData_ = hasBuffer ? recvBuffers_.get() + bid * kRecvBufferSize : nullptr;
+                channel->recvResult_ = cqe.res;
+                if (cqe.res > 0) {
+                    savedSyscalls_.store(savedSyscalls_.load(std::memory_order_relaxed) + 1,
+                                         std::memory_order_relaxed);
+                }
+                report(slot, 0, activeChannels);
+            }
+        } else {
+            if (entry.channel == nullptr || (entry.requestGeneration & 0x3fffffff) != generation) {
+                auto iter = cancelledSends_.find(cqe.user_data);
+                if (iter != cancelledSends_.end()) {
+                    releasedKeepAlives_.push_back(std::move(iter->second->keepAlive));
+                    cancelledSends_.erase(iter);
+                }
+                continue;
+            }
+            releasedKeepAlives_.push_back(std::move(entry.send->keepAlive));
+            freeSendRequests_.push_back(std::move(entry.send));
+            Channel* channel = entry.channel;
+            channel->sendCompleted_ = true;
+            channel->sendResult_ = cqe.res;
+            if (cqe.res >= 0) {
+                savedSyscalls_.store(savedSyscalls_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            }
+            report(slot, 0, activeChannels);
+        }
+        // The requests are one-shot, they are submitted again before the next
+        // wait, after the channel has had a chance to change its interest.
+        queueArm(slot);
+    }
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+    for (size_t slot : reportedSlots_) {
+        entries_[slot].reported = false;
+    }
+    reportedSlots_.clear();
+}
+
+void IoUringPoller::report(size_t slot, int revents, ChannelList* activeChannels) {
+    // A poll, a receive and a send of the same channel can complete in one
+    // iteration, the channel is handled once for all of them.
+    Entry& entry = entries_[slot];
+    if (entry.reported) {
+        entry.channel->setRevents(entry.channel->revents() | revents);
+        return;
+    }
+    entry.reported = true;
+    reportedSlots_.push_back(slot);
+    entry.channel->setRevents(revents);
+    activeChannels->push_back(entry.channel);
+}
+
+void IoUringPoller::armPendingChannels() {
+    // getSqe() may flush the submission queue, but never touches
+    // pendingArms_, so iterating by index is safe.
+    for (size_t i = 0; i < pendingArms_.size(); ++i) {
+        size_t slot = pendingArms_[i];
+        entries_[slot].pendingArm = false;
+        if (!armChannel(slot)) {
+            // Retry the remaining ones in the next iteration.
+            entries_[slot].pendingArm = true;
+            pendingArms_.erase(pendingArms_.begin(), pendingArms_.begin() + i);
+            return;
+        }
+    }
+    pendingArms_.clear();
+}
+
+bool IoUringPoller::armChannel(size_t slot) {
+    Entry& entry = entries_[slot];
+    Channel* channel = entry.channel;
+    if (channel == nullptr) {
+        return true;
+    }
+    uint32_t events = static_cast<uint32_t>(channel->events());
+    uint32_t pollEvents = events;
+    if ((events & POLLIN) && channel->recvCallback_ && !entry.recvFallback && provideRecvBuffers()) {
+        // A cancelled receive may still complete with data, the next one is
+        // submitted after its completion.
+        if (!entry.recvInFlight && !submitRecv(slot)) {
+            return false;
+        }
+        pollEvents &= ~static_cast<uint32_t>(Channel::kReadEvent);
+    } else if (entry.recvInFlight && !entry.recvCancelled && !(events & POLLIN)) {
+        cancelRequest(userData(slot, kRecv, entry.requestGeneration));
+        entry.recvCancelled = true;
+    }
+    if ((events & POLLOUT) && channel->sendPrepareCallback_) {
+        if (entry.send || submitSend(slot)) {
+            pollEvents &= ~static_cast<uint32_t>(POLLOUT);
+        }
+    }
+    if (pollEvents == entry.armedEvents) {
+        return true;
+    }
+    if (entry.armedEvents != 0) {
+        cancelPoll(slot);
+    }
+    return pollEvents == 0 || submitPoll(slot, pollEvents);
+}
+
+bool IoUringPoller::submitPoll(size_t slot, uint32_t events) {
+    io_uring_sqe* sqe = getSqe();
+    if (!sqe) {
+        return false;
+    }
+    Entry& entry = entries_[slot];
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = entry.channel->fd();
+    sqe->poll32_events = events;
+    sqe->user_data = userData(slot, kPoll, entry.generation);
+    entry.armedEvents = events;
+    ++requestsInFlight_;
+    return true;
+}
+
+bool IoUringPoller::submitRecv(size_t slot) {
+    io_uring_sqe* sqe = getSqe();
+    if (!sqe) {
+        return false;
+    }
+    Entry& entry = entries_[slot];
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = entry.channel->fd();
+    sqe->len = kRecvBufferSize;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = kRecvBufferGroup;
+    sqe->user_data = userData(slot, kRecv, entry.requestGeneration);
+    entry.recvInFlight = true;
+    ++requestsInFlight_;
+    return true;
+}
+
+bool IoUringPoller::submitSend(size_t slot) {
+    Entry& entry = entries_[slot];
+    std::unique_ptr<SendRequest> send;
+    if (!freeSendRequests_.empty()) {
+        send = std::move(freeSendRequests_.back());
+        freeSendRequests_.pop_back();
+    } else {
+        send.reset(new SendRequest);
+    }
+    int flags = 0;
+    int count = entry.channel->sendPrepareCallback_(send->vec, kMaxSendIovecs, &flags, &send->keepAlive);
+    if (count <= 0) {
+        // Nothing to send this way, wait for a write event instead.
+        send->keepAlive.reset();
+        freeSendRequests_.push_back(std::move(send));
+        return false;
+    }
+    io_uring_sqe* sqe = getSqe();
+    if (!sqe) {
+        send->keepAlive.reset();
+        freeSendRequests_.push_back(std::move(send));
+        return false;
+    }
+    memset(&send->msg, 0, sizeof(send->msg));
+    send->msg.msg_iov = send->vec;
+    send->msg.msg_iovlen = count;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = entry.channel->fd();
+    sqe->addr = reinterpret_cast<uint64_t>(&send->msg);
+    sqe->len = 1;
+    sqe->msg_flags = static_cast<uint32_t>(flags);
+    sqe->user_data = userData(slot, kSend, entry.requestGeneration);
+    entry.send = std::move(send);
+    ++requestsInFlight_;
+    return true;
+}
+
+void IoUringPoller::cancelPoll(size_t slot) {
+    Entry& entry = entries_[slot];
+    assert(entry.armedEvents != 0);
+    io_uring_sqe* sqe = getSqe();
+    if (sqe) {
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = userData(slot, kPoll, entry.generation);
+        sqe->user_data = kCancelUserData;
+    }
+    ++entry.generation;
+    entry.armedEvents = 0;
+}
+
+void IoUringPoller::cancelRequest(uint64_t userData) {
+    io_uring_sqe* sqe = getSqe();
+    if (sqe) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = userData;
+        sqe->user_data = kCancelUserData;
+    }
+}
+
+void IoUringPoller::cancelAllRequests() {
+    // The requests of removed channels have been cancelled already.
+    for (size_t slot = 0; slot < entries_.size(); ++slot) {
+        Entry& entry = entries_[slot];
+        if (entry.channel == nullptr) {
+            continue;
+        }
+        if (entry.armedEvents != 0) {
+            cancelPoll(slot);
+        }
+        if (entry.recvInFlight && !entry.recvCancelled) {
+            cancelRequest(userData(slot, kRecv, entry.requestGeneration));
+        }
+        if (entry.send) {
+            cancelRequest(userData(slot, kSend, entry.requestGeneration));
+        }
+    }
+    // Wait for the completions of all of them, but do not hang on a request
+    // the kernel fails to cancel.
+    for (int i = 0; i < 100 && requestsInFlight_ > 0; ++i) {
+        submitAndWait(10);
+        unsigned head = *cqHead_;
+        unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            if (cqes_[head & cqMask_].user_data != kCancelUserData) {
+                --requestsInFlight_;
+            }
+        }
+        __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+    }
+    if (requestsInFlight_ > 0) {
+        LOG_ERROR << requestsInFlight_ << " io_uring requests still in flight when the poller is destroyed";
+    }
+}
+
+void IoUringPoller::queueArm(size_t slot) {
+    Entry& entry = entries_[slot];
+    if (!entry.pendingArm) {
+        entry.pendingArm = true;
+        pendingArms_.push_back(slot);
+    }
+}
+
+bool IoUringPoller::provideRecvBuffers() {
+    if (recvBuffers_) {
+        return true;
+    }
+    io_uring_sqe* sqe = getSqe();
+    if (!sqe) {
+        return false;
+    }
+    recvBuffers_.reset(new char[kRecvBufferCount * kRecvBufferSize]);
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = static_cast<int>(kRecvBufferCount);
+    sqe->addr = reinterpret_cast<uint64_t>(recvBuffers_.get());
+    sqe->len = kRecvBufferSize;
+    sqe->off = 0;
+    sqe->buf_group = kRecvBufferGroup;
+    sqe->user_data = kCancelUserData;
+    return true;
+}
+
+void IoUringPoller::recycleRecvBuffers() {
+    while (!usedRecvBuffers_.empty()) {
+        io_uring_sqe* sqe = getSqe();
+        if (!sqe) {
+            return;
+        }
+        uint16_t bid = usedRecvBuffers_.back();
+        usedRecvBuffers_.pop_back();
+        sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+        sqe->fd = 1;
+        sqe->addr = reinterpret_cast<uint64_t>(recvBuffers_.get() + bid * kRecvBufferSize);
+        sqe->len = kRecvBufferSize;
+        sqe->off = bid;
+        sqe->buf_group = kRecvBufferGroup;
+        sqe->user_data = kCancelUserData;
+    }
+}
+
+void IoUringPoller::updateChannel(Channel* channel) {
+    assertInLoopThread();
+    assert(channel->fd() >= 0);
+    int index = channel->index();
+    if (index == kNew) {
+        size_t slot;
+        if (!freeSlots_.empty()) {
+            slot = freeSlots_.back();
+            freeSlots_.pop_back();
+        } else {
+            slot = entries_.size();
+            entries_.emplace_back();
+        }
+        entries_[slot].channel = channel;
+        channel->setIndex(static_cast<int>(slot));
+        index = static_cast<int>(slot);
+    }
+    size_t slot = static_cast<size_t>(index);
+    assert(slot < entries_.size());
+    assert(entries_[slot].channel == channel);
+    // The requests are compared with the new interest before the next wait.
+    queueArm(slot);
+}
+
+void IoUringPoller::removeChannel(Channel* channel) {
+    assertInLoopThread();
+    assert(channel->isNoneEvent());
+    int index = channel->index();
+    assert(index >= 0 && static_cast<size_t>(index) < entries_.size());
+    size_t slot = static_cast<size_t>(index);
+    Entry& entry = entries_[slot];
+    assert(entry.channel == channel);
+    if (entry.armedEvents != 0) {
+        cancelPoll(slot);
+    }
+    if (entry.recvInFlight && !entry.recvCancelled) {
+        cancelRequest(userData(slot, kRecv, entry.requestGeneration));
+    }
+    if (entry.send) {
+        // The kernel may still read the iovecs, they are kept until the send
+        // completes.
+        uint64_t sendUserData = userData(slot, kSend, entry.requestGeneration);
+        cancelRequest(sendUserData);
+        cancelledSends_[sendUserData] = std::move(entry.send);
+    }
+    // Completions of requests that were already queued are discarded by the
+    // generation check.
+    ++entry.generation;
+    ++entry.requestGeneration;
+    entry.recvInFlight = false;
+    entry.recvCancelled = false;
+    entry.recvFallback = false;
+    entry.channel = nullptr;
+    freeSlots_.push_back(slot);
+    channel->setIndex(kNew);
+}
+
+}  // namespace cooper
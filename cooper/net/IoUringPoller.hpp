@@ -0,0 +1,160 @@
+#ifndef net_IoUringPoller_hpp
+#define net_IoUringPoller_hpp
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "cooper/net/EventLoop.hpp"
+#include "cooper/net/Poller.hpp"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace cooper {
+class Channel;
+
+/**
+ * @brief A poller backed by io_uring. Every channel is watched by a one-shot
+ * IORING_OP_POLL_ADD request, so the level-triggered semantics of EpollPoller
+ * are kept. Re-arming polls and changing the interest of channels only queue
+ * SQEs, which are submitted together with the wait for completions in a single
+ * io_uring_enter() call per loop iteration.
+ *
+ * The channels with a receive callback are read by IORING_OP_RECV requests
+ * into the buffers provided by the poller instead of waiting for read events,
+ * and the ones with send callbacks are written by IORING_OP_SENDMSG requests
+ * instead of waiting for write events, so no read() or write() call is made
+ * for them.
+ */
+class IoUringPoller : public Poller {
+public:
+    explicit IoUringPoller(EventLoop* loop);
+    virtual ~IoUringPoller();
+    virtual void poll(int timeoutMs, ChannelList* activeChannels) override;
+    virtual void updateChannel(Channel* channel) override;
+    virtual void removeChannel(Channel* channel) override;
+    virtual PollerType type() const override {
+        return PollerType::kIoUring;
+    }
+
+    /**
+     * @brief Return false if io_uring is not usable on the running kernel. The
+     * caller should fall back to another poller in that case.
+     *
+     * @return true
+     * @return false
+     */
+    bool valid() const {
+        return ringFd_ >= 0;
+    }
+
+    /**
+     * @brief Return the number of read() and write() calls saved by the
+     * completed receive and send requests.
+     *
+     * @return size_t
+     */
+    virtual size_t savedSyscalls() const override {
+        return savedSyscalls_.load(std::memory_order_relaxed);
+    }
+
+private:
+    static const unsigned kRingEntries = 1024;
+    static const int kMaxSendIovecs = 64;
+    static const unsigned kRecvBufferCount = 64;
+    static const size_t kRecvBufferSize = 32 * 1024;
+    static const uint16_t kRecvBufferGroup = 0;
+
+    enum RequestKind : uint32_t { kPoll = 0, kRecv = 1, kSend = 2 };
+
+    struct SendRequest {
+        struct msghdr msg;
+        struct iovec vec[kMaxSendIovecs];
+        std::shared_ptr<void> keepAlive;
+    };
+
+    struct Entry {
+        Channel* channel{nullptr};
+        // Bumped whenever an in-flight poll is cancelled, so that its
+        // completion can be recognized as stale.
+        uint32_t generation{0};
+        // Bumped when the channel is removed, the completions of its reads and
+        // sends are stale after that.
+        uint32_t requestGeneration{0};
+        // The events of the in-flight poll request, 0 if there is none.
+        uint32_t armedEvents{0};
+        bool pendingArm{false};
+        bool reported{false};
+        bool recvInFlight{false};
+        bool recvCancelled{false};
+        // Set when no receive buffer is left, the read events are waited for
+        // instead until one is reported.
+        bool recvFallback{false};
+        // The send in flight, only one at a time to keep the order of data.
+        std::unique_ptr<SendRequest> send;
+    };
+
+    io_uring_sqe* getSqe();
+    void submitAndWait(int timeoutMs);
+    void reapCompletions(ChannelList* activeChannels);
+    void report(size_t slot, int revents, ChannelList* activeChannels);
+    void armPendingChannels();
+    bool armChannel(size_t slot);
+    bool submitPoll(size_t slot, uint32_t events);
+    bool submitRecv(size_t slot);
+    bool submitSend(size_t slot);
+    void cancelPoll(size_t slot);
+    void cancelRequest(uint64_t userData);
+    void cancelAllRequests();
+    void queueArm(size_t slot);
+    bool provideRecvBuffers();
+    void recycleRecvBuffers();
+    static uint64_t userData(size_t slot, RequestKind kind, uint32_t generation) {
+        return (static_cast<uint64_t>(slot) << 32) | (static_cast<uint64_t>(kind) << 30) | (generation & 0x3fffffff);
+    }
+
+    int ringFd_{-1};
+    void* ringPtr_{nullptr};
+    size_t ringSize_{0};
+    io_uring_sqe* sqes_{nullptr};
+    size_t sqesSize_{0};
+    unsigned* sqHead_{nullptr};
+    unsigned* sqTail_{nullptr};
+    unsigned* sqArray_{nullptr};
+    unsigned sqMask_{0};
+    unsigned sqEntries_{0};
+    unsigned sqLocalTail_{0};
+    unsigned* cqHead_{nullptr};
+    unsigned* cqTail_{nullptr};
+    unsigned cqMask_{0};
+    io_uring_cqe* cqes_{nullptr};
+
+    std::vector<Entry> entries_;
+    std::vector<size_t> freeSlots_;
+    std::vector<size_t> pendingArms_;
+    std::vector<size_t> reportedSlots_;
+    // The poll, receive and send requests whose completions have not been
+    // reaped yet.
+    size_t requestsInFlight_{0};
+
+    std::unique_ptr<char[]> recvBuffers_;
+    // The buffers passed to the receive callbacks in the last iteration, they
+    // are given back to the kernel in the next one.
+    std::vector<uint16_t> usedRecvBuffers_;
+    // The sends of removed channels, which are kept until they complete.
+    std::unordered_map<uint64_t, std::unique_ptr<SendRequest>> cancelledSends_;
+    std::vector<std::unique_ptr<SendRequest>> freeSendRequests_;
+    // The objects kept alive by the sends completed in the last iteration,
+    // released after the send callbacks have been called.
+    std::vector<std::shared_ptr<void>> releasedKeepAlives_;
+    std::atomic<size_t> savedSyscalls_{0};
+};
+}  // namespace cooper
+
+#endif
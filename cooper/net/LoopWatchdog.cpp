@@ -0,0 +1,173 @@
+#include "LoopWatchdog.hpp"
+
+#include <cxxabi.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <typeinfo>
+
+#include "cooper/util/Logger.hpp"
+
+namespace cooper {
+namespace {
+void backtraceSignalHandler(int) {
+    // backtrace() has been called once when the handler is installed, so it
+    // doesn't allocate memory here.
+    void* frames[64];
+    int n = ::backtrace(frames, 64);
+    static const char header[] = "Backtrace of the stuck event loop thread:\n";
+    ssize_t ret = ::write(STDERR_FILENO, header, sizeof(header) - 1);
+    (void)ret;
+    ::backtrace_symbols_fd(frames, n, STDERR_FILENO);
+}
+
+void installBacktraceSignalHandler() {
+    static std::once_flag flag;
+    std::call_once(flag, []() {
+        void* frames[1];
+        ::backtrace(frames, 1);
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = backtraceSignalHandler;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        if (::sigaction(SIGRTMIN, &sa, nullptr) < 0) {
+            LOG_SYSERR << "sigaction";
+        }
+    });
+}
+
+std::string demangle(const char* name) {
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+    if (status != 0 || demangled == nullptr) {
+        return name;
+    }
+    std::string result(demangled);
+    free(demangled);
+    return result;
+}
+}  // namespace
+
+std::string LoopStall::toString() const {
+    std::string desc = "EventLoop ";
+    if (loop->index() != std::numeric_limits<size_t>::max()) {
+        desc += std::to_string(loop->index()) + " ";
+    }
+    desc += "is stuck for " + std::to_string(duration.count()) + "ms ";
+    switch (activity) {
+        case LoopActivity::kHandlingEvent:
+            desc += "in handling the events of fd " + std::to_string(id);
+            break;
+        case LoopActivity::kRunningFunction:
+            desc += "in running a queued function of type " +
+                    demangle(reinterpret_cast<const std::type_info*>(id)->name());
+            break;
+        case LoopActivity::kRunningTimer:
+            desc += "in running the timer " + std::to_string(id);
+            break;
+        default:
+            desc += "in polling";
+            break;
+    }
+    return desc;
+}
+
+LoopWatchdog::LoopWatchdog(const std::chrono::milliseconds& threshold, bool dumpBacktrace)
+    : threshold_(threshold), dumpBacktrace_(dumpBacktrace), stallCallback_([](const LoopStall& stall) {
+          LOG_WARN << stall.toString();
+      }) {
+}
+
+LoopWatchdog::~LoopWatchdog() {
+    stop();
+}
+
+void LoopWatchdog::watch(EventLoop* loop) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.push_back({loop, loop->heartbeat().count, std::chrono::steady_clock::now(), false});
+}
+
+void LoopWatchdog::unwatch(EventLoop* loop) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.erase(std::remove_if(entries_.begin(), entries_.end(),
+                                  [loop](const Entry& entry) {
+                                      return entry.loop == loop;
+                                  }),
+                   entries_.end());
+}
+
+void LoopWatchdog::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) {
+        return;
+    }
+    if (dumpBacktrace_) {
+        installBacktraceSignalHandler();
+    }
+    running_ = true;
+    thread_ = std::thread([this]() {
+        run();
+    });
+}
+
+void LoopWatchdog::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+    }
+    cond_.notify_all();
+    thread_.join();
+}
+
+void LoopWatchdog::run() {
+    ::prctl(PR_SET_NAME, "LoopWatchdog");
+    // Sample several times per threshold so that a stall is detected soon
+    // after it exceeds the threshold.
+    auto interval = std::max(threshold_ / 4, std::chrono::milliseconds(1));
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_) {
+        cond_.wait_for(lock, interval);
+        if (running_) {
+            check(std::chrono::steady_clock::now());
+        }
+    }
+}
+
+void LoopWatchdog::check(const std::chrono::steady_clock::time_point& now) {
+    for (auto& entry : entries_) {
+        LoopHeartbeat beat = entry.loop->heartbeat();
+        if (beat.count != entry.count) {
+            entry.count = beat.count;
+            entry.since = now;
+            entry.reported = false;
+            continue;
+        }
+        if (entry.reported || beat.activity == LoopActivity::kPolling || now - entry.since < threshold_) {
+            continue;
+        }
+        entry.reported = true;
+        LoopStall stall;
+        stall.loop = entry.loop;
+        stall.activity = beat.activity;
+        stall.id = beat.id;
+        stall.duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - entry.since);
+        if (stallCallback_) {
+            stallCallback_(stall);
+        }
+        if (dumpBacktrace_) {
+            pthread_kill(entry.loop->pthreadId_, SIGRTMIN);
+        }
+    }
+}
+
+}  // namespace cooper
@@ -0,0 +1,119 @@
+#ifndef net_LoopWatchdog_hpp
+#define net_LoopWatchdog_hpp
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cooper/net/EventLoop.hpp"
+#include "cooper/util/NonCopyable.hpp"
+
+namespace cooper {
+/**
+ * @brief The information of an event loop that is stuck in an activity.
+ *
+ */
+struct LoopStall {
+    EventLoop* loop{nullptr};
+    LoopActivity activity{LoopActivity::kPolling};
+    uint64_t id{0};
+    // How long the event loop has been stuck when it is detected.
+    std::chrono::milliseconds duration{0};
+
+    /**
+     * @brief Return a human readable description of the stall, such as the fd
+     * of the channel or the type of the queued function.
+     *
+     * @return std::string
+     */
+    std::string toString() const;
+};
+
+using LoopStallCallback = std::function<void(const LoopStall&)>;
+
+/**
+ * @brief This class represents a thread that samples the heartbeats of event
+ * loops and reports the ones stuck in handling an event, a queued function or
+ * a timer longer than a threshold, which usually means a callback blocks the
+ * thread of the event loop.
+ * @note The watched event loops must outlive the watchdog or be unwatched
+ * before they are destroyed.
+ */
+class LoopWatchdog : NonCopyable {
+public:
+    /**
+     * @brief Construct a new watchdog.
+     *
+     * @param threshold The time after which an event loop that makes no
+     * progress is reported.
+     * @param dumpBacktrace If true, the stuck thread is interrupted by a
+     * signal (SIGRTMIN) to write its backtrace to stderr.
+     */
+    explicit LoopWatchdog(const std::chrono::milliseconds& threshold, bool dumpBacktrace = false);
+    ~LoopWatchdog();
+
+    /**
+     * @brief Start to watch an event loop.
+     *
+     * @param loop
+     */
+    void watch(EventLoop* loop);
+
+    /**
+     * @brief Stop watching an event loop.
+     *
+     * @param loop
+     */
+    void unwatch(EventLoop* loop);
+
+    /**
+     * @brief Set the callback called in the thread of the watchdog when a stall
+     * is detected, the default one logs the stall as a warning.
+     *
+     * @param cb
+     */
+    void setStallCallback(const LoopStallCallback& cb) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stallCallback_ = cb;
+    }
+
+    /**
+     * @brief Start the thread of the watchdog.
+     *
+     */
+    void start();
+
+    /**
+     * @brief Stop the thread of the watchdog.
+     *
+     */
+    void stop();
+
+private:
+    void run();
+    void check(const std::chrono::steady_clock::time_point& now);
+
+    struct Entry {
+        EventLoop* loop;
+        uint64_t count;
+        std::chrono::steady_clock::time_point since;
+        bool reported;
+    };
+
+    std::chrono::milliseconds threshold_;
+    bool dumpBacktrace_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool running_{false};
+    std::vector<Entry> entries_;
+    LoopStallCallback stallCallback_;
+    std::thread thread_;
+};
+
+}  // namespace cooper
+
+#endif
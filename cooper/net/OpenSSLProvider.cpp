@@ -4,12 +4,32 @@
 #include <openssl/x509v3.h>
 
 #include <array>
+#include <cctype>
+#include <cstring>
 #include <fstream>
 #include <limits>
 #include <list>
 #include <memory>
 #include <mutex>
 #include <unordered_map>
+#include <vector>
+
+// The kernel TLS is set up with the keys derived by the KDFs of OpenSSL 3.
+#if defined(__linux__) && !defined(LIBRESSL_VERSION_NUMBER) && OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <linux/tls.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/core_names.h>
+#include <openssl/kdf.h>
+#include <sys/socket.h>
+#define COOPER_KERNEL_TLS
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#endif
 
 #include "cooper/net/TLSProvider.hpp"
 #include "cooper/net/TcpConnection.hpp"
@@ -131,6 +151,84 @@ static int serverSelectProtocol(SSL* ssl, const unsigned char** out, unsigned ch
     return SSL_TLSEXT_ERR_NOACK;
 }
 
+#ifdef COOPER_KERNEL_TLS
+static bool deriveKey(const char* kdfName, const OSSL_PARAM* params, unsigned char* out, size_t len) {
+    EVP_KDF* kdf = EVP_KDF_fetch(nullptr, kdfName, nullptr);
+    if (kdf == nullptr)
+        return false;
+    EVP_KDF_CTX* kctx = EVP_KDF_CTX_new(kdf);
+    EVP_KDF_free(kdf);
+    if (kctx == nullptr)
+        return false;
+    bool ok = EVP_KDF_derive(kctx, out, len, params) > 0;
+    EVP_KDF_CTX_free(kctx);
+    return ok;
+}
+
+// HKDF-Expand-Label of TLS 1.3 with an empty context, see RFC 8446 7.1
+static bool hkdfExpandLabel(const EVP_MD* md, const std::vector<unsigned char>& secret, const std::string& label,
+                            unsigned char* out, size_t len) {
+    std::string fullLabel = "tls13 " + label;
+    std::vector<unsigned char> info;
+    info.push_back(static_cast<unsigned char>(len >> 8));
+    info.push_back(static_cast<unsigned char>(len));
+    info.push_back(static_cast<unsigned char>(fullLabel.size()));
+    info.insert(info.end(), fullLabel.begin(), fullLabel.end());
+    info.push_back(0);
+    int mode = EVP_KDF_HKDF_MODE_EXPAND_ONLY;
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_int(OSSL_KDF_PARAM_MODE, &mode),
+        OSSL_PARAM_construct_utf8_string(OSSL_KDF_PARAM_DIGEST, const_cast<char*>(EVP_MD_get0_name(md)), 0),
+        OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_KEY, const_cast<unsigned char*>(secret.data()),
+                                          secret.size()),
+        OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_INFO, info.data(), info.size()),
+        OSSL_PARAM_construct_end()};
+    return deriveKey(OSSL_KDF_NAME_HKDF, params, out, len);
+}
+
+// The key block of TLS 1.2, see RFC 5246 6.3
+static bool tls12KeyBlock(const SSL* ssl, const EVP_MD* md, unsigned char* out, size_t len) {
+    unsigned char masterKey[SSL_MAX_MASTER_KEY_LENGTH];
+    size_t masterKeyLen = SSL_SESSION_get_master_key(SSL_get0_session(ssl), masterKey, sizeof(masterKey));
+    std::vector<unsigned char> seed(13 + 2 * SSL3_RANDOM_SIZE);
+    memcpy(seed.data(), "key expansion", 13);
+    SSL_get_server_random(ssl, seed.data() + 13, SSL3_RANDOM_SIZE);
+    SSL_get_client_random(ssl, seed.data() + 13 + SSL3_RANDOM_SIZE, SSL3_RANDOM_SIZE);
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_utf8_string(OSSL_KDF_PARAM_DIGEST, const_cast<char*>(EVP_MD_get0_name(md)), 0),
+        OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_SECRET, masterKey, masterKeyLen),
+        OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_SEED, seed.data(), seed.size()),
+        OSSL_PARAM_construct_end()};
+    bool ok = deriveKey(OSSL_KDF_NAME_TLS1_PRF, params, out, len);
+    OPENSSL_cleanse(masterKey, sizeof(masterKey));
+    return ok;
+}
+
+// The nonce is the salt followed by the IV of the kernel.
+template <typename CryptoInfo>
+static void fillCryptoInfo(CryptoInfo& info, uint16_t version, uint16_t cipherType, const unsigned char* key,
+                           const unsigned char* nonce, const unsigned char* recSeq) {
+    info.info.version = version;
+    info.info.cipher_type = cipherType;
+    memcpy(info.key, key, sizeof(info.key));
+    memcpy(info.salt, nonce, sizeof(info.salt));
+    memcpy(info.iv, nonce + sizeof(info.salt), sizeof(info.iv));
+    memcpy(info.rec_seq, recSeq, sizeof(info.rec_seq));
+}
+
+// Count the records with the content type application_data in TLS data.
+static size_t countApplicationRecords(const unsigned char* data, size_t len) {
+    size_t count = 0;
+    size_t pos = 0;
+    while (pos + 5 <= len) {
+        if (data[pos] == 23)
+            ++count;
+        pos += 5 + ((size_t(data[pos + 3]) << 8) | data[pos + 4]);
+    }
+    return count;
+}
+#endif
+
 }  // namespace internal
 
 namespace cooper {
@@ -364,9 +462,13 @@ struct OpenSSLProvider : public TLSProvider, public NonCopyable {
         SSL_set_bio(ssl_, rbio_, wbio_);
         if (!policyPtr_->getHostname().empty())
             SSL_set_tlsext_host_name(ssl_, policyPtr_->getHostname().c_str());
+        // For the key log callback, which captures the traffic secret of TLS 1.3
+        if (policyPtr_->getUseKernelTLS())
+            SSL_set_app_data(ssl_, this);
     }
 
     virtual ~OpenSSLProvider() {
+        OPENSSL_cleanse(txSecret_.data(), txSecret_.size());
         SSL_free(ssl_);
     }
 
@@ -426,6 +528,10 @@ struct OpenSSLProvider : public TLSProvider, public NonCopyable {
     virtual void close() override {
         if (!SSL_is_init_finished(ssl_))
             return;
+        if (kernelTLS_) {
+            sendKernelCloseNotify();
+            return;
+        }
         SSL_shutdown(ssl_);
         sendTLSData();
     }
@@ -435,6 +541,8 @@ struct OpenSSLProvider : public TLSProvider, public NonCopyable {
             errno = EAGAIN;
             return -1;
         }
+        if (kernelTLS_)
+            return writeCallback_(conn_, data, len);
         // Limit the size of the data we send in one go to avoid holding massive
         // buffers in memory.
         constexpr size_t maxSend = 64 * 1024;
@@ -515,6 +623,9 @@ struct OpenSSLProvider : public TLSProvider, public NonCopyable {
                 }
             }
 
+            // Before the handshake callback, in which data may be sent.
+            if (policyPtr_->getUseKernelTLS())
+                enableKernelTLS();
             if (handshakeCallback_)
                 handshakeCallback_(conn_);
             sendTLSData();  // Needed to send ChangeCipherSpec
@@ -551,6 +662,14 @@ struct OpenSSLProvider : public TLSProvider, public NonCopyable {
             // clamp to int, because that's what SSL_read accepts
             const size_t wrtibleSize = (std::min)(maxWritibleBytes, recvBuffer_.writableBytes());
             int n = SSL_read(ssl_, recvBuffer_.beginWrite(), (int)wrtibleSize);
+#ifdef COOPER_KERNEL_TLS
+            // The keys in the kernel can't follow a key update.
+            if (kernelTLS_ && (SSL_get_key_update_type(ssl_) != SSL_KEY_UPDATE_NONE || BIO_pending(wbio_) > 0)) {
+                LOG_ERROR << "The peer requested a key update, which is not supported with kernel TLS";
+                handleSSLError(SSLError::kSSLProtocolError);
+                return;
+            }
+#endif
             int shutdownState = SSL_get_shutdown(ssl_);
             if (n == 0 && (shutdownState & SSL_RECEIVED_SHUTDOWN)) {
                 LOG_TRACE << "SSL connection closed by peer";
@@ -578,6 +697,11 @@ struct OpenSSLProvider : public TLSProvider, public NonCopyable {
             return -1;
         if (len == 0)
             return 0;
+        if (kernelTLS_) {
+            // Encrypted with the keys that the kernel has taken over.
+            BIO_reset(wbio_);
+            return -1;
+        }
         int n = writeCallback_(conn_, data, len);
 
         int offset = n;
@@ -599,13 +723,189 @@ struct OpenSSLProvider : public TLSProvider, public NonCopyable {
             errorCallback_(conn_, error);
     }
 
+    void onKeyLog(const char* line) {
+        // <label> <client random> <secret> in hex
+        std::string label = contextPtr_->isServer ? "SERVER_TRAFFIC_SECRET_0 " : "CLIENT_TRAFFIC_SECRET_0 ";
+        if (strncmp(line, label.data(), label.size()) != 0)
+            return;
+        const char* secret = strchr(line + label.size(), ' ');
+        if (secret == nullptr)
+            return;
+        ++secret;
+        txSecret_.clear();
+        for (size_t i = 0; isxdigit(secret[i]) && isxdigit(secret[i + 1]); i += 2) {
+            txSecret_.push_back(
+                static_cast<unsigned char>(OPENSSL_hexchar2int(secret[i]) << 4 | OPENSSL_hexchar2int(secret[i + 1])));
+        }
+    }
+
+    void enableKernelTLS() {
+#ifdef COOPER_KERNEL_TLS
+        // The records encrypted with the traffic keys but not sent yet, the
+        // session tickets of a TLS 1.3 server, take the first sequence numbers.
+        void* data = nullptr;
+        long len = BIO_get_mem_data(wbio_, &data);
+        size_t pendingRecords = len > 0 ? internal::countApplicationRecords((unsigned char*)data, len) : 0;
+        sendTLSData();
+        if (fd_ < 0 || writeBuffer_.readableBytes() != 0) {
+            LOG_DEBUG << "Kernel TLS not enabled: the handshake is not sent completely";
+            return;
+        }
+
+        const SSL_CIPHER* cipher = SSL_get_current_cipher(ssl_);
+        const EVP_MD* md = cipher ? SSL_CIPHER_get_handshake_digest(cipher) : nullptr;
+        int version = SSL_version(ssl_);
+        if (md == nullptr || (version != TLS1_2_VERSION && version != TLS1_3_VERSION)) {
+            LOG_DEBUG << "Kernel TLS not enabled: unsupported protocol version";
+            return;
+        }
+        uint16_t cipherType;
+        size_t keyLen;
+        size_t fixedIvLen;
+        switch (SSL_CIPHER_get_cipher_nid(cipher)) {
+            case NID_aes_128_gcm:
+                cipherType = TLS_CIPHER_AES_GCM_128;
+                keyLen = TLS_CIPHER_AES_GCM_128_KEY_SIZE;
+                fixedIvLen = TLS_CIPHER_AES_GCM_128_SALT_SIZE;
+                break;
+            case NID_aes_256_gcm:
+                cipherType = TLS_CIPHER_AES_GCM_256;
+                keyLen = TLS_CIPHER_AES_GCM_256_KEY_SIZE;
+                fixedIvLen = TLS_CIPHER_AES_GCM_256_SALT_SIZE;
+                break;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+            case NID_chacha20_poly1305:
+                cipherType = TLS_CIPHER_CHACHA20_POLY1305;
+                keyLen = TLS_CIPHER_CHACHA20_POLY1305_KEY_SIZE;
+                fixedIvLen = TLS_CIPHER_CHACHA20_POLY1305_IV_SIZE;
+                break;
+#endif
+            default:
+                LOG_DEBUG << "Kernel TLS not enabled: unsupported cipher " << SSL_CIPHER_get_name(cipher);
+                return;
+        }
+
+        // The nonce is 12 bytes for all the ciphers. In TLS 1.2, the part
+        // after the fixed IV of GCM is the explicit nonce, which is the
+        // sequence number as the kernel does.
+        unsigned char key[32];
+        unsigned char nonce[12];
+        uint64_t seq;
+        bool derived;
+        if (version == TLS1_3_VERSION) {
+            seq = contextPtr_->isServer ? pendingRecords : 0;
+            derived = !txSecret_.empty() && internal::hkdfExpandLabel(md, txSecret_, "key", key, keyLen) &&
+                      internal::hkdfExpandLabel(md, txSecret_, "iv", nonce, sizeof(nonce));
+        } else {
+            // The Finished message is the first record with the keys.
+            seq = 1;
+            unsigned char keyBlock[2 * (32 + 12)];
+            size_t blockLen = 2 * (keyLen + fixedIvLen);
+            derived = internal::tls12KeyBlock(ssl_, md, keyBlock, blockLen);
+            if (derived) {
+                size_t side = contextPtr_->isServer ? 1 : 0;
+                memcpy(key, keyBlock + side * keyLen, keyLen);
+                memcpy(nonce, keyBlock + 2 * keyLen + side * fixedIvLen, fixedIvLen);
+                for (size_t i = fixedIvLen; i < sizeof(nonce); ++i) {
+                    nonce[i] = static_cast<unsigned char>(seq >> (8 * (sizeof(nonce) - 1 - i)));
+                }
+            }
+            OPENSSL_cleanse(keyBlock, sizeof(keyBlock));
+        }
+        OPENSSL_cleanse(txSecret_.data(), txSecret_.size());
+        txSecret_.clear();
+        if (!derived) {
+            OPENSSL_cleanse(key, sizeof(key));
+            LOG_DEBUG << "Kernel TLS not enabled: failed to derive the keys";
+            return;
+        }
+
+        unsigned char recSeq[8];
+        for (size_t i = 0; i < sizeof(recSeq); ++i) {
+            recSeq[i] = static_cast<unsigned char>(seq >> (8 * (sizeof(recSeq) - 1 - i)));
+        }
+        uint16_t tlsVersion = version == TLS1_3_VERSION ? TLS_1_3_VERSION : TLS_1_2_VERSION;
+        union {
+            tls12_crypto_info_aes_gcm_128 aes128;
+            tls12_crypto_info_aes_gcm_256 aes256;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+            tls12_crypto_info_chacha20_poly1305 chacha20;
+#endif
+        } info;
+        socklen_t infoLen = 0;
+        memset(&info, 0, sizeof(info));
+        if (cipherType == TLS_CIPHER_AES_GCM_128) {
+            internal::fillCryptoInfo(info.aes128, tlsVersion, cipherType, key, nonce, recSeq);
+            infoLen = sizeof(info.aes128);
+        } else if (cipherType == TLS_CIPHER_AES_GCM_256) {
+            internal::fillCryptoInfo(info.aes256, tlsVersion, cipherType, key, nonce, recSeq);
+            infoLen = sizeof(info.aes256);
+        } else {
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+            internal::fillCryptoInfo(info.chacha20, tlsVersion, cipherType, key, nonce, recSeq);
+            infoLen = sizeof(info.chacha20);
+#endif
+        }
+        OPENSSL_cleanse(key, sizeof(key));
+
+        // The socket works as before if the keys are not taken after the TLS
+        // upper layer protocol is attached.
+        bool enabled = setsockopt(fd_, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) == 0 &&
+                       setsockopt(fd_, SOL_TLS, TLS_TX, &info, infoLen) == 0;
+        int err = errno;
+        OPENSSL_cleanse(&info, sizeof(info));
+        if (!enabled) {
+            LOG_DEBUG << "Kernel TLS not enabled: " << strerror(err);
+            return;
+        }
+        kernelTLS_ = true;
+        LOG_TRACE << "Kernel TLS enabled with " << SSL_CIPHER_get_name(cipher);
+#endif
+    }
+
+    void sendKernelCloseNotify() {
+#ifdef COOPER_KERNEL_TLS
+        // A warning alert of close_notify, which is sent as a record of the
+        // alert type by the kernel.
+        unsigned char alert[2] = {1, 0};
+        char control[CMSG_SPACE(sizeof(unsigned char))];
+        struct iovec iov = {alert, sizeof(alert)};
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        memset(control, 0, sizeof(control));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_TLS;
+        cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned char));
+        *CMSG_DATA(cmsg) = 21;
+        if (::sendmsg(fd_, &msg, MSG_NOSIGNAL) < 0)
+            LOG_TRACE << "Failed to send close_notify: " << strerror(errno);
+        SSL_set_shutdown(ssl_, SSL_get_shutdown(ssl_) | SSL_SENT_SHUTDOWN);
+#endif
+    }
+
     SSL* ssl_;
     BIO* rbio_;
     BIO* wbio_;
     bool processedHandshakeError_{false};
     bool processedSslError_{false};
+    // The traffic secret of TLS 1.3 for sending, until it is installed into
+    // the kernel.
+    std::vector<unsigned char> txSecret_;
 };
 
+#ifdef COOPER_KERNEL_TLS
+static void keyLogCallback(const SSL* ssl, const char* line) {
+    auto provider = static_cast<OpenSSLProvider*>(SSL_get_app_data(ssl));
+    if (provider)
+        provider->onKeyLog(line);
+}
+#endif
+
 std::shared_ptr<TLSProvider> cooper::newTLSProvider(TcpConnection* conn, TLSPolicyPtr policy, SSLContextPtr ctx) {
     return std::make_shared<OpenSSLProvider>(conn, std::move(policy), std::move(ctx));
 }
@@ -655,6 +955,16 @@ SSLContextPtr cooper::newSSLContext(const TLSPolicy& policy, bool isServer) {
         SSL_CTX_set_alpn_select_cb(ctx->ctx(), internal::serverSelectProtocol, (void*)&policy.getAlpnProtocols());
     }
 
+    if (policy.getUseKernelTLS()) {
+#ifdef COOPER_KERNEL_TLS
+        SSL_CTX_set_keylog_callback(ctx->ctx(), keyLogCallback);
+        // The keys in the kernel can't be changed.
+        SSL_CTX_set_options(ctx->ctx(), SSL_OP_NO_RENEGOTIATION);
+#else
+        LOG_WARN << "Kernel TLS is not supported on this platform or by this TLS library";
+#endif
+    }
+
     if (!isServer) {
         // We have our own session cache, so disable OpenSSL's
         SSL_CTX_set_session_cache_mode(ctx->ctx(), SSL_SESS_CACHE_OFF);
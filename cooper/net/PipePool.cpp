@@ -0,0 +1,49 @@
+#include "PipePool.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cooper/util/Logger.hpp"
+
+namespace cooper {
+PipePool& PipePool::instance() {
+    static thread_local PipePool pool;
+    return pool;
+}
+
+PipePool::~PipePool() {
+    for (auto& pipe : pipes_) {
+        close(pipe);
+    }
+}
+
+bool PipePool::acquire(Pipe& pipe) {
+    if (!pipes_.empty()) {
+        pipe = pipes_.back();
+        pipes_.pop_back();
+        return true;
+    }
+    int fds[2];
+    if (::pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+        LOG_SYSERR << "pipe2";
+        return false;
+    }
+    pipe.readFd = fds[0];
+    pipe.writeFd = fds[1];
+    return true;
+}
+
+void PipePool::release(const Pipe& pipe, bool empty) {
+    if (!empty || pipes_.size() >= kMaxIdlePipes) {
+        close(pipe);
+        return;
+    }
+    pipes_.push_back(pipe);
+}
+
+void PipePool::close(const Pipe& pipe) {
+    ::close(pipe.readFd);
+    ::close(pipe.writeFd);
+}
+
+}  // namespace cooper
@@ -0,0 +1,60 @@
+#ifndef net_PipePool_hpp
+#define net_PipePool_hpp
+
+#include <cstddef>
+#include <vector>
+
+#include "cooper/util/NonCopyable.hpp"
+
+namespace cooper {
+/**
+ * @brief This class represents a pool of the pipes used to move data between
+ * sockets with splice(). Every thread has its own pool, so every event loop
+ * reuses the pipes of its connections without locking.
+ *
+ */
+class PipePool : NonCopyable {
+public:
+    struct Pipe {
+        int readFd{-1};
+        int writeFd{-1};
+    };
+
+    /**
+     * @brief Return the pool of the current thread.
+     *
+     * @return PipePool&
+     */
+    static PipePool& instance();
+
+    ~PipePool();
+
+    /**
+     * @brief Get an empty pipe from the pool, a new one is created if the pool
+     * is empty.
+     *
+     * @param pipe
+     * @return false if no pipe can be created.
+     */
+    bool acquire(Pipe& pipe);
+
+    /**
+     * @brief Return a pipe to the pool.
+     *
+     * @param pipe
+     * @param empty False if some data is left in the pipe, then the pipe is
+     * closed instead of being reused.
+     */
+    void release(const Pipe& pipe, bool empty = true);
+
+private:
+    PipePool() = default;
+    static void close(const Pipe& pipe);
+
+    static constexpr size_t kMaxIdlePipes = 16;
+    std::vector<Pipe> pipes_;
+};
+
+}  // namespace cooper
+
+#endif
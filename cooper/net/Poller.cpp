@@ -1,8 +1,18 @@
 #include "Poller.hpp"
 
 #include "cooper/net/EpollPoller.hpp"
+#include "cooper/net/IoUringPoller.hpp"
+#include "cooper/util/Logger.hpp"
 
 using namespace cooper;
-Poller* Poller::newPoller(EventLoop* loop) {
+Poller* Poller::newPoller(EventLoop* loop, PollerType type) {
+    if (type == PollerType::kIoUring) {
+        auto poller = new IoUringPoller(loop);
+        if (poller->valid()) {
+            return poller;
+        }
+        delete poller;
+        LOG_WARN << "io_uring is not available, fall back to epoll";
+    }
     return new EpollPoller(loop);
 }
@@ -22,7 +22,20 @@ public:
     virtual void removeChannel(Channel* channel) = 0;
     virtual void resetAfterFork() {
     }
-    static Poller* newPoller(EventLoop* loop);
+    virtual PollerType type() const {
+        return PollerType::kEpoll;
+    }
+
+    /**
+     * @brief Return the number of system calls saved by the poller, e.g. by
+     * coalescing the interest changes of channels. This method is thread safe.
+     *
+     * @return size_t
+     */
+    virtual size_t savedSyscalls() const {
+        return 0;
+    }
+    static Poller* newPoller(EventLoop* loop, PollerType type = PollerType::kEpoll);
 
 private:
     EventLoop* ownerLoop_;
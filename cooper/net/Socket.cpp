@@ -1,10 +1,13 @@
 #include "Socket.hpp"
 
+#include <linux/sockios.h>
 #include <netinet/tcp.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 
 #include <cassert>
+#include <cstring>
 
 #include "cooper/util/Logger.hpp"
 
@@ -119,6 +122,19 @@ void Socket::setKeepAlive(bool on) {
     // TODO CHECK
 }
 
+void Socket::setBusyPoll(int usec) {
+#ifdef SO_BUSY_POLL
+    int ret = ::setsockopt(sockFd_, SOL_SOCKET, SO_BUSY_POLL, &usec, static_cast<socklen_t>(sizeof usec));
+    if (ret < 0) {
+        LOG_SYSERR << "SO_BUSY_POLL failed.";
+    }
+#else
+    if (usec > 0) {
+        LOG_ERROR << "SO_BUSY_POLL is not supported.";
+    }
+#endif
+}
+
 int Socket::getSocketError() {
     int optval;
     socklen_t optlen = static_cast<socklen_t>(sizeof optval);
@@ -130,6 +146,20 @@ int Socket::getSocketError() {
     }
 }
 
+bool Socket::getTcpInfo(struct tcp_info* info) const {
+    socklen_t len = static_cast<socklen_t>(sizeof(*info));
+    memset(info, 0, sizeof(*info));
+    return ::getsockopt(sockFd_, IPPROTO_TCP, TCP_INFO, info, &len) == 0;
+}
+
+size_t Socket::getSendQueueBytes() const {
+    int bytes = 0;
+    if (::ioctl(sockFd_, SIOCOUTQ, &bytes) < 0) {
+        return 0;
+    }
+    return static_cast<size_t>(bytes);
+}
+
 Socket::~Socket() {
     LOG_TRACE << "Socket deconstructed:" << sockFd_;
     if (sockFd_ >= 0)
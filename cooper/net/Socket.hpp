@@ -10,6 +10,8 @@
 #include "cooper/util/Logger.hpp"
 #include "cooper/util/NonCopyable.hpp"
 
+struct tcp_info;
+
 namespace cooper {
 class Socket : NonCopyable {
 public:
@@ -77,8 +79,24 @@ public:
     /// Enable/disable SO_KEEPALIVE
     ///
     void setKeepAlive(bool on);
+
+    ///
+    /// Set SO_BUSY_POLL, the time in microseconds to busy poll the device
+    /// queue on blocking receives, 0 to disable
+    ///
+    void setBusyPoll(int usec);
     int getSocketError();
 
+    ///
+    /// Get TCP_INFO, return false on failure
+    ///
+    bool getTcpInfo(struct tcp_info* info) const;
+
+    ///
+    /// Get the bytes in the send queue, not sent or not acknowledged yet
+    ///
+    size_t getSendQueueBytes() const;
+
 protected:
     int sockFd_;
 
@@ -122,6 +122,21 @@ struct TLSPolicy final {
         return *this;
     }
 
+    /**
+     * @brief Hand the encryption of the sent data over to the kernel (kTLS)
+     * after the handshake, so that files are sent with sendfile() and data is
+     * written without being copied through the TLS library. The connection
+     * silently keeps encrypting in the TLS library if the kernel, the TLS
+     * library or the negotiated cipher doesn't support it.
+     *
+     * @note Only the sending side is offloaded. Renegotiation is disabled and
+     * a TLS 1.3 key update requested by the peer closes the connection.
+     */
+    TLSPolicy& setUseKernelTLS(bool useKernelTLS) {
+        useKernelTLS_ = useKernelTLS;
+        return *this;
+    }
+
     // The getters
     const std::vector<std::pair<std::string, std::string>>& getConfCmds() const {
         return sslConfCmds_;
@@ -157,6 +172,9 @@ struct TLSPolicy final {
     bool getUseSystemCertStore() const {
         return useSystemCertStore_;
     }
+    bool getUseKernelTLS() const {
+        return useKernelTLS_;
+    }
 
     static std::shared_ptr<TLSPolicy> defaultServerPolicy(const std::string& certPath, const std::string& keyPath) {
         auto policy = std::make_shared<TLSPolicy>();
@@ -182,6 +200,7 @@ protected:
     bool validate_ = true;
     bool allowBrokenChain_ = false;
     bool useSystemCertStore_ = true;
+    bool useKernelTLS_ = false;
 };
 using TLSPolicyPtr = std::shared_ptr<TLSPolicy>;
 }  // namespace cooper
@@ -92,6 +92,23 @@ struct TLSProvider {
         closeCallback_ = cb;
     }
 
+    /**
+     * @brief Set the socket of the connection, which is needed to hand the
+     * encryption over to the kernel.
+     */
+    void setSocketFd(int fd) {
+        fd_ = fd;
+    }
+
+    /**
+     * @brief Return true if the data is encrypted by the kernel, then
+     * sendData() writes the data as it is and the connection may write to the
+     * socket directly, e.g. with sendfile().
+     */
+    bool kernelTLSEnabled() const {
+        return kernelTLS_;
+    }
+
     MsgBuffer& getRecvBuffer() {
         return recvBuffer_;
     }
@@ -135,6 +152,8 @@ protected:
     std::string applicationProtocol_;
     std::string sniName_;
     MsgBuffer writeBuffer_;
+    int fd_ = -1;
+    bool kernelTLS_ = false;
 };
 
 std::shared_ptr<TLSProvider> newTLSProvider(TcpConnection* conn, TLSPolicyPtr policy, SSLContextPtr ctx);
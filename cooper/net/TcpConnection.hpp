@@ -22,6 +22,62 @@ class TimingWheel;
 struct SSLContext;
 using SSLContextPtr = std::shared_ptr<SSLContext>;
 
+/**
+ * @brief A piece of memory to be sent, see TcpConnection::send(const
+ * std::vector<BufferSlice>&).
+ *
+ */
+struct BufferSlice {
+    const void* data;
+    size_t length;
+};
+
+/**
+ * @brief The statistics of the sending and receiving of a connection, see
+ * TcpConnection::stats().
+ *
+ */
+struct TcpConnectionStats {
+    size_t bytesSent{0};
+    size_t bytesReceived{0};
+    // The bytes queued for writing in user space, now and at most.
+    size_t queuedBytes{0};
+    size_t peakQueuedBytes{0};
+    // The writes to the socket that were taken in part, and the ones that
+    // were refused because the socket was full.
+    uint64_t partialWrites{0};
+    uint64_t wouldBlockWrites{0};
+    // The time since the last read of data from the socket and the last write
+    // of data to it, or since the connection was created if none yet.
+    std::chrono::microseconds sinceLastRead{0};
+    std::chrono::microseconds sinceLastWrite{0};
+};
+
+/**
+ * @brief A sample of the state of a connection kept by the kernel, see
+ * TcpConnection::tcpInfo().
+ *
+ */
+struct TcpInfo {
+    // The smoothed round-trip time and its mean deviation.
+    std::chrono::microseconds rtt{0};
+    std::chrono::microseconds rttVar{0};
+    // The congestion window and the slow start threshold in segments, and
+    // the maximum segment size.
+    uint32_t sndCwnd{0};
+    uint32_t sndSsthresh{0};
+    uint32_t sndMss{0};
+    // The segments sent but not acknowledged, the ones considered lost, the
+    // retransmissions of the current timeout and all of them.
+    uint32_t unacked{0};
+    uint32_t lost{0};
+    uint32_t retransmits{0};
+    uint32_t totalRetrans{0};
+    // The bytes in the send queue of the socket, not sent or not
+    // acknowledged yet.
+    size_t sendQueueBytes{0};
+};
+
 /**
  * @brief This class represents a TCP connection.
  *
@@ -47,9 +103,45 @@ public:
     virtual void send(std::string&& msg) = 0;
     virtual void send(const MsgBuffer& buffer) = 0;
     virtual void send(MsgBuffer&& buffer) = 0;
+
+    /**
+     * @brief Send a shared buffer to the peer. The data that can't be written
+     * to the socket right away is copied, so the buffer may be modified once
+     * the call is handled in the thread of the event loop.
+     *
+     * @param msgPtr
+     */
     virtual void send(const std::shared_ptr<std::string>& msgPtr) = 0;
     virtual void send(const std::shared_ptr<MsgBuffer>& msgPtr) = 0;
 
+    /**
+     * @brief Send a shared buffer to the peer without copying it. The
+     * connection holds a reference to the buffer until all of its data is
+     * written to the socket, so the same buffer can be sent to many
+     * connections at the cost of one copy.
+     *
+     * @param msgPtr
+     * @param cb The callback is called in the thread of the event loop of the
+     * connection when the connection releases the buffer, with true if all the
+     * data has been written to the socket, false if the data is dropped
+     * because the connection is closed. It is not called if the event loop has
+     * quit by then.
+     * @note The buffer must not be modified until it is released.
+     */
+    virtual void send(const std::shared_ptr<std::string>& msgPtr, const SendCompleteCallback& cb) = 0;
+    virtual void send(const std::shared_ptr<MsgBuffer>& msgPtr, const SendCompleteCallback& cb) = 0;
+
+    /**
+     * @brief Send several pieces of memory to the peer, such as the header, the
+     * body and the trailer of a message, in one system call if possible,
+     * without concatenating them first.
+     *
+     * @param slices
+     * @note The memory of the slices is not used after the method returns, the
+     * part that can't be sent immediately is copied.
+     */
+    virtual void send(const std::vector<BufferSlice>& slices) = 0;
+
     /**
      * @brief Send json to the peer.
      *
@@ -86,6 +178,25 @@ public:
     virtual void sendStream(std::function<std::size_t(char*, std::size_t)> callback) = 0;  // (buffer, buffer size) ->
                                                                                            // size of data put in buffer
 
+    /**
+     * @brief Hold the small data sent in the thread of the event loop until
+     * the end of the current loop iteration, and then write all of it at once,
+     * so that a response sent with several calls, e.g. a header, a body and a
+     * file, goes out in fewer system calls and packets. When a file follows
+     * the data, the data is sent with MSG_MORE to share packets with the file.
+     *
+     * @param on false (default) writes the data of every send right away if
+     * the socket can take it.
+     * @note The data sent in other threads is never held.
+     */
+    virtual void setAutoCork(bool on) = 0;
+
+    /**
+     * @brief Write the data held by the auto cork right away, in the order of
+     * the sends.
+     */
+    virtual void flush() = 0;
+
     /**
      * @brief Get the local address of the connection.
      *
@@ -132,6 +243,99 @@ public:
      */
     virtual void setHighWaterMarkCallback(const HighWaterMarkCallback& cb, size_t markLen) = 0;
 
+    /**
+     * @brief Stop reading from the socket, the data from the peer stays in the
+     * socket buffer until startRead() is called, so the peer is slowed down by
+     * TCP flow control.
+     *
+     */
+    virtual void stopRead() = 0;
+
+    /**
+     * @brief Resume reading from the socket after stopRead() is called.
+     *
+     */
+    virtual void startRead() = 0;
+
+    /**
+     * @brief Pause reading from the socket when the data queued to be sent
+     * exceeds the high mark, and resume it when the queued data drains to the
+     * low mark. This keeps the memory bounded when the peer sends requests
+     * faster than it reads the responses.
+     *
+     * @param highMark The high mark in bytes, 0 disables the flow control.
+     * @param lowMark The low mark in bytes, which should be less than the high
+     * mark.
+     * @note Reading stopped by stopRead() is not resumed by the flow control.
+     */
+    virtual void setFlowControl(size_t highMark, size_t lowMark) = 0;
+
+    /**
+     * @brief Return the number of bytes in memory queued to be sent, files
+     * and streams are not counted. This method can be called in any thread,
+     * e.g. a relay checks the connection it writes to and calls stopRead() on
+     * the one it reads from.
+     *
+     * @return size_t
+     */
+    virtual size_t queuedBytes() const = 0;
+
+    /**
+     * @brief Release the memory of the read buffer when no data is received
+     * on the connection for a while, e.g. for a large number of mostly idle
+     * connections. The buffer is allocated again when data arrives.
+     *
+     * @param seconds The idle time, 0 disables the release.
+     * @note The read buffer is always sized by the recent reads, it grows for
+     * large reads and shrinks when the reads become small again.
+     */
+    virtual void setReadBufferIdleTime(double seconds) = 0;
+
+    /**
+     * @brief Read from the socket repeatedly until it is drained or the budget
+     * is used up, and pass all the data read to the message callback at once.
+     * This saves system calls and callbacks for a peer that sends at a high
+     * rate, in exchange for a larger read buffer.
+     *
+     * @param bytes The budget in bytes of one batch, 0 disables batching
+     * (default), in which case the callback is called after every read.
+     * @note The budget is a soft limit, a read may exceed it by the empty
+     * space of the read buffer.
+     */
+    virtual void setReadBatchBytes(size_t bytes) = 0;
+
+    /**
+     * @brief Limit the rates of reading from and writing to the socket with
+     * token buckets. When the tokens run out, the reading or the writing is
+     * paused and resumed by a timer of the event loop, the data sent in the
+     * meantime is queued, see setFlowControl() to bound it.
+     *
+     * @param readBytesPerSecond 0 for no limit on reading.
+     * @param writeBytesPerSecond 0 for no limit on writing.
+     * @param burstBytes The number of bytes that can be read or written at
+     * once after an idle period, one tenth of the rate if 0.
+     * @note The limits apply to the bytes on the wire, i.e. the encrypted
+     * data of a TLS connection, and add to the limits of the server, see
+     * TcpServer::setRateLimit().
+     */
+    virtual void setRateLimit(size_t readBytesPerSecond, size_t writeBytesPerSecond, size_t burstBytes = 0) = 0;
+
+    /**
+     * @brief Forward the data received on the connection to another connection
+     * instead of passing it to the message callback, e.g. in a relay. If
+     * neither connection is encrypted and both are handled in the same event
+     * loop, the data is moved from socket to socket with splice() without
+     * being copied to user space, otherwise it is sent with send(). Reading
+     * from the connection is paused while the target can't take more data.
+     *
+     * @param target The connection to forward to, nullptr to stop forwarding.
+     * @note The data sent to the target by other means may be interleaved
+     * with the forwarded data. The forwarding stops when the target is closed
+     * or fails to take the data, as if nullptr was passed, and the data not
+     * yet sent to it is dropped.
+     */
+    virtual void forwardTo(const TcpConnectionPtr& target) = 0;
+
     /**
      * @brief Set the TCP_NODELAY option to the socket.
      *
@@ -229,6 +433,24 @@ public:
      */
     virtual size_t bytesReceived() const = 0;
 
+    /**
+     * @brief Return the statistics of the connection. This method can be
+     * called in any thread, the counters are updated by the thread of the
+     * event loop without locking, so they are not a consistent snapshot.
+     *
+     * @return TcpConnectionStats
+     */
+    virtual TcpConnectionStats stats() const = 0;
+
+    /**
+     * @brief Sample the state of the connection in the kernel (TCP_INFO). This
+     * method can be called in any thread.
+     *
+     * @param info
+     * @return false if the state can't be read, e.g. the connection is closed.
+     */
+    virtual bool tcpInfo(TcpInfo* info) const = 0;
+
     /**
      * @brief Check whether the connection is SSL encrypted.
      *
@@ -288,6 +510,20 @@ public:
     void setRecvMsgCallback(RecvMessageCallback&& cb) {
         recvMsgCallback_ = std::move(cb);
     }
+    /**
+     * @brief Receive the data of the connection into a RingBuffer and pass it
+     * to this callback instead of the message callback, so the data left in
+     * the buffer is never moved when more is read.
+     * @note It must be set before the connection is established, e.g. in the
+     * connection callback. The data of a TLS connection is always passed to
+     * the message callback.
+     */
+    void setRecvRingMsgCallback(const RecvRingMessageCallback& cb) {
+        recvRingMsgCallback_ = cb;
+    }
+    void setRecvRingMsgCallback(RecvRingMessageCallback&& cb) {
+        recvRingMsgCallback_ = std::move(cb);
+    }
     void setConnectionCallback(const ConnectionCallback& cb) {
         connectionCallback_ = cb;
     }
@@ -321,6 +557,7 @@ public:
 protected:
     // callbacks
     RecvMessageCallback recvMsgCallback_;
+    RecvRingMessageCallback recvRingMsgCallback_;
     ConnectionCallback connectionCallback_;
     CloseCallback closeCallback_;
     WriteCompleteCallback writeCompleteCallback_;
@@ -1,12 +1,18 @@
 #include "TcpConnectionImpl.hpp"
 
 #include <fcntl.h>
+#include <limits.h>
+#include <netinet/tcp.h>
 #include <poll.h>
+#include <sys/mman.h>
 #include <sys/sendfile.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <limits>
+
 #include "cooper/net/Channel.hpp"
 #include "cooper/net/Socket.hpp"
 #include "cooper/util/Utilities.hpp"
@@ -14,6 +20,10 @@
 using namespace cooper;
 
 static const int kMaxSendFileBufferSize = 16 * 1024;
+static int64_t steadyMicroseconds() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
 TcpConnectionImpl::TcpConnectionImpl(EventLoop* loop, int socketfd, const InetAddress& localAddr,
                                      const InetAddress& peerAddr, TLSPolicyPtr policy, SSLContextPtr ctx)
     : loop_(loop),
@@ -26,12 +36,24 @@ TcpConnectionImpl::TcpConnectionImpl(EventLoop* loop, int socketfd, const InetAd
     ioChannelPtr_->setWriteCallback(std::bind(&TcpConnectionImpl::writeCallback, this));
     ioChannelPtr_->setCloseCallback(std::bind(&TcpConnectionImpl::handleClose, this));
     ioChannelPtr_->setErrorCallback(std::bind(&TcpConnectionImpl::handleError, this));
+    if (loop_->pollerType() == PollerType::kIoUring) {
+        completionIo_ = true;
+        ioChannelPtr_->setRecvCallback(std::bind(&TcpConnectionImpl::recvCompletion, this, std::placeholders::_1,
+                                                 std::placeholders::_2));
+        ioChannelPtr_->setSendCallbacks(std::bind(&TcpConnectionImpl::prepareSend, this, std::placeholders::_1,
+                                                  std::placeholders::_2, std::placeholders::_3,
+                                                  std::placeholders::_4),
+                                        std::bind(&TcpConnectionImpl::sendCompletion, this, std::placeholders::_1));
+    }
     socketPtr_->setKeepAlive(true);
     name_ = localAddr.toIpPort() + "--" + peerAddr.toIpPort();
+    lastReadTimeUs_.store(steadyMicroseconds(), std::memory_order_relaxed);
+    lastWriteTimeUs_.store(lastReadTimeUs_.load(std::memory_order_relaxed), std::memory_order_relaxed);
 
     if (policy != nullptr) {
         tlsProviderPtr_ = newTLSProvider(this, policy, ctx);
         tlsProviderPtr_->setWriteCallback(onSslWrite);
+        tlsProviderPtr_->setSocketFd(socketPtr_->fd());
         tlsProviderPtr_->setErrorCallback(onSslError);
         tlsProviderPtr_->setHandshakeCallback(onHandshakeFinished);
         tlsProviderPtr_->setMessageCallback(onSslMessage);
@@ -43,40 +65,288 @@ TcpConnectionImpl::~TcpConnectionImpl() {
     // send a close alert to peer if we are still connected
     if (tlsProviderPtr_ && status_ == ConnStatus::Connected)
         tlsProviderPtr_->close();
+    // The pool of the loop thread may not be accessible here.
+    if (forwardPipe_.readFd >= 0) {
+        close(forwardPipe_.readFd);
+        close(forwardPipe_.writeFd);
+    }
+    // In case the connection is destroyed without being closed.
+    notifyForwardSourceOfClose();
 }
 
 void TcpConnectionImpl::readCallback() {
     // LOG_TRACE<<"read Callback";
     loop_->assertInLoopThread();
-    int ret = 0;
-
-    ssize_t n = readBuffer_.readFd(socketPtr_->fd(), &ret);
-    // LOG_TRACE<<"read "<<n<<" bytes from socket";
+    auto target = forwardTarget_.lock();
+    if (target && canSpliceTo(*target) && spliceToTarget(target)) {
+        return;
+    }
+    for (;;) {
+        size_t quota = 0;
+        if (readRateLimited()) {
+            quota = readQuota();
+            if (quota == 0) {
+                pauseReadingForRateLimit();
+                return;
+            }
+        }
+        int ret = 0;
+        bool more = false;
+        bool ring = readsIntoRing();
+        ssize_t n = ring ? readInto(ringReadBuffer_, quota, &ret, &more) : readInto(readBuffer_, quota, &ret, &more);
+        // LOG_TRACE<<"read "<<n<<" bytes from socket";
+        if (n == 0) {
+            // socket closed by peer
+            handleClose();
+            return;
+        } else if (n < 0) {
+            if (errno == EPIPE || errno == ECONNRESET) {
+                LOG_TRACE << "EPIPE or ECONNRESET, errno=" << errno << " fd=" << socketPtr_->fd();
+                return;
+            }
+            if (errno == EAGAIN)  // TODO: any others?
+            {
+                LOG_TRACE << "EAGAIN, errno=" << errno << " fd=" << socketPtr_->fd();
+                return;
+            }
+            LOG_SYSERR << "read socket error";
+            handleClose();
+            return;
+        }
+        deliverReceived(n, ring, quota > 0);
+        // In edge-triggered mode, keep reading until the socket is drained.
+        // A read that doesn't fill the buffer means there is nothing left,
+        // unless the peer has shut down its writing, in which case the next
+        // read returns 0 and no more event would be reported for it.
+        if (!ioChannelPtr_->isEdgeTriggered() || !ioChannelPtr_->isReading() ||
+            (!more && !(ioChannelPtr_->revents() & POLLRDHUP))) {
+            return;
+        }
+    }
+}
+void TcpConnectionImpl::deliverReceived(size_t n, bool ring, bool limited) {
+    extendLife();
+    addBytes(bytesReceived_, n);
+    countRead();
+    if (limited) {
+        consumeReadQuota(n);
+    }
+    if (ring) {
+        deliverRingMessage();
+        adjustReadBuffer(ringReadBuffer_, n);
+    } else {
+        if (tlsProviderPtr_) {
+            tlsProviderPtr_->recvData(&readBuffer_);
+        } else {
+            deliverMessage(&readBuffer_);
+        }
+        adjustReadBuffer(readBuffer_, n);
+    }
+}
+void TcpConnectionImpl::recvCompletion(const char* data, ssize_t n) {
+    loop_->assertInLoopThread();
+    if (status_ == ConnStatus::Disconnected) {
+        return;
+    }
     if (n == 0) {
         // socket closed by peer
         handleClose();
-    } else if (n < 0) {
-        if (errno == EPIPE || errno == ECONNRESET) {
-            LOG_TRACE << "EPIPE or ECONNRESET, errno=" << errno << " fd=" << socketPtr_->fd();
+        return;
+    }
+    if (n < 0) {
+        errno = static_cast<int>(-n);
+        if (errno == EAGAIN || errno == EINTR) {
             return;
         }
-        if (errno == EAGAIN)  // TODO: any others?
-        {
-            LOG_TRACE << "EAGAIN, errno=" << errno << " fd=" << socketPtr_->fd();
-            return;
+        // No event is waited for besides the receives, so the connection is
+        // closed here rather than by a close event.
+        if (errno == EPIPE || errno == ECONNRESET) {
+            LOG_TRACE << "EPIPE or ECONNRESET, errno=" << errno << " fd=" << socketPtr_->fd();
+        } else {
+            LOG_SYSERR << "recv socket error";
         }
-        LOG_SYSERR << "read socket error";
         handleClose();
         return;
     }
-    extendLife();
+    // The data is in a buffer of the poller, it is copied to the read buffer
+    // and forwarded from there if the connection forwards to another one.
+    bool ring = readsIntoRing();
+    size_t hint = std::max(readSizeHint(), static_cast<size_t>(n));
+    if (ring) {
+        ringReadBuffer_.ensureWritableBytes(hint);
+        ringReadBuffer_.append(data, n);
+    } else {
+        readBuffer_.ensureWritableBytes(hint);
+        readBuffer_.append(data, n);
+    }
+    bool limited = readRateLimited();
+    deliverReceived(n, ring, limited);
+    // A receive may take more than the quota, the buckets go into debt then.
+    if (limited && status_ != ConnStatus::Disconnected && readQuota() == 0) {
+        pauseReadingForRateLimit();
+    }
+}
+// The memory a batched read spills into beyond the empty part of the read
+// buffer, shared by the connections in a thread.
+static constexpr size_t kReadSpillSize = 256 * 1024;
+static char* readSpillArea() {
+    thread_local std::unique_ptr<char[]> area(new char[kReadSpillSize]);
+    return area.get();
+}
+template <typename Buffer>
+ssize_t TcpConnectionImpl::readInto(Buffer& buffer, size_t quota, int* retErrno, bool* more) {
+    // Make room for a read of the usual size, so that it doesn't go
+    // through the extra buffer of readFd() and get copied again.
+    size_t hint = readSizeHint();
+    if (buffer.writableBytes() < hint) {
+        buffer.ensureWritableBytes(hint);
+    }
+    if (quota > 0) {
+        return readWithQuota(buffer, quota, more);
+    }
+    if (readBatchBytes_ > 0) {
+        return readBatch(buffer, retErrno, more);
+    }
+    size_t writable = buffer.writableBytes();
+    ssize_t n = buffer.readFd(socketPtr_->fd(), retErrno);
+    *more = n > 0 && static_cast<size_t>(n) >= writable;
+    return n;
+}
+template <typename Buffer>
+ssize_t TcpConnectionImpl::readBatch(Buffer& buffer, int* retErrno, bool* more) {
+    char* spill = readSpillArea();
+    size_t total = 0;
+    for (;;) {
+        // One readv() takes as much of the remaining budget as the read buffer
+        // and the spill area can hold, the spilled part is appended to the read
+        // buffer with one copy.
+        size_t writable = buffer.writableBytes();
+        size_t budget = readBatchBytes_ - total;
+        size_t extLength = budget > writable ? std::min(budget - writable, kReadSpillSize) : 0;
+        ssize_t n = buffer.readFd(socketPtr_->fd(), retErrno, spill, extLength);
+        if (n <= 0) {
+            if (total == 0) {
+                return n;
+            }
+            // Deliver the data read so far, the end of the stream or the error
+            // is found again by the next read.
+            *more = n == 0 || *retErrno != EAGAIN;
+            return static_cast<ssize_t>(total);
+        }
+        total += n;
+        if (static_cast<size_t>(n) < writable + extLength) {
+            *more = false;
+            return static_cast<ssize_t>(total);
+        }
+        if (total >= readBatchBytes_) {
+            *more = true;
+            return static_cast<ssize_t>(total);
+        }
+    }
+}
+ssize_t TcpConnectionImpl::readWithQuota(MsgBuffer& buffer, size_t quota, bool* more) {
+    // A read which stops at the quota leaves the rest of the data in the
+    // socket, where it is subject to the flow control of TCP.
+    size_t len = std::min(buffer.writableBytes(), quota);
+    ssize_t n = ::read(socketPtr_->fd(), buffer.beginWrite(), len);
     if (n > 0) {
-        bytesReceived_ += n;
-        if (tlsProviderPtr_) {
-            tlsProviderPtr_->recvData(&readBuffer_);
-        } else if (recvMsgCallback_) {
-            recvMsgCallback_(shared_from_this(), &readBuffer_);
+        buffer.hasWritten(n);
+    }
+    *more = n > 0 && static_cast<size_t>(n) >= len;
+    return n;
+}
+ssize_t TcpConnectionImpl::readWithQuota(RingBuffer& buffer, size_t quota, bool* more) {
+    // The empty part of a ring may be in two pieces, so the data is read into
+    // the spill area and then appended.
+    size_t len = std::min(std::min(buffer.writableBytes(), quota), kReadSpillSize);
+    ssize_t n = ::read(socketPtr_->fd(), readSpillArea(), len);
+    if (n > 0) {
+        buffer.append(readSpillArea(), n);
+    }
+    *more = n > 0 && static_cast<size_t>(n) >= len;
+    return n;
+}
+void TcpConnectionImpl::setReadBatchBytes(size_t bytes) {
+    auto thisPtr = shared_from_this();
+    loop_->runInLoop([thisPtr, bytes]() {
+        thisPtr->readBatchBytes_ = bytes;
+    });
+}
+void TcpConnectionImpl::setAutoCork(bool on) {
+    auto thisPtr = shared_from_this();
+    loop_->runInLoop([thisPtr, on]() {
+        thisPtr->autoCork_ = on;
+        if (!on) {
+            thisPtr->flushInLoop();
         }
+    });
+}
+size_t TcpConnectionImpl::readSizeHint() const {
+    return std::min(std::max(readSizeEstimate_, kBufferDefaultLength), kMaxReadSizeHint);
+}
+template <typename Buffer>
+void TcpConnectionImpl::adjustReadBuffer(Buffer& buffer, size_t n) {
+    readSizeEstimate_ = (readSizeEstimate_ * 7 + n) / 8;
+    if (buffer.readableBytes() != 0) {
+        return;
+    }
+    // Give back the memory of a buffer that grew for a burst once the reads
+    // are small again, with a margin so that it doesn't shrink and grow
+    // repeatedly.
+    size_t hint = readSizeHint();
+    if (buffer.capacity() > hint * 4) {
+        buffer.shrink(hint);
+    }
+    if (readBufferIdleTime_ > 0 && readBufferTimerId_ == InvalidTimerId) {
+        scheduleReadBufferRelease(readBufferIdleTime_);
+    }
+}
+void TcpConnectionImpl::setReadBufferIdleTime(double seconds) {
+    auto thisPtr = shared_from_this();
+    loop_->runInLoop([thisPtr, seconds]() {
+        thisPtr->readBufferIdleTime_ = seconds;
+        if (thisPtr->readBufferTimerId_ != InvalidTimerId) {
+            thisPtr->loop_->invalidateTimer(thisPtr->readBufferTimerId_);
+            thisPtr->readBufferTimerId_ = InvalidTimerId;
+        }
+        if (seconds > 0) {
+            thisPtr->scheduleReadBufferRelease(seconds);
+        }
+    });
+}
+void TcpConnectionImpl::scheduleReadBufferRelease(double delay) {
+    // Only one timer per connection is pending at any time, and it doesn't
+    // keep the connection alive.
+    std::weak_ptr<TcpConnectionImpl> weakPtr = shared_from_this();
+    readBufferTimerId_ = loop_->runAfter(delay, [weakPtr]() {
+        auto thisPtr = weakPtr.lock();
+        if (thisPtr) {
+            thisPtr->releaseIdleReadBuffer();
+        }
+    });
+}
+void TcpConnectionImpl::releaseIdleReadBuffer() {
+    readBufferTimerId_ = InvalidTimerId;
+    if (status_ == ConnStatus::Disconnected || readBufferIdleTime_ <= 0) {
+        return;
+    }
+    // The time of the last read is recorded by countRead().
+    double idleTime =
+        static_cast<double>(steadyMicroseconds() - lastReadTimeUs_.load(std::memory_order_relaxed)) / 1000000;
+    if (idleTime < readBufferIdleTime_) {
+        scheduleReadBufferRelease(readBufferIdleTime_ - idleTime);
+        return;
+    }
+    // The data of an incomplete message is kept, the buffer is checked again
+    // after the next read.
+    if (readBuffer_.readableBytes() == 0 && readBuffer_.capacity() > 0) {
+        readBuffer_.shrink(0);
+    }
+    if (ringReadBuffer_.readableBytes() == 0 && ringReadBuffer_.capacity() > 0) {
+        ringReadBuffer_.shrink(0);
+    }
+    if (tlsProviderPtr_ && tlsProviderPtr_->getRecvBuffer().readableBytes() == 0) {
+        tlsProviderPtr_->getRecvBuffer().shrink(0);
     }
 }
 void TcpConnectionImpl::extendLife() {
@@ -96,6 +366,45 @@ void TcpConnectionImpl::extendLife() {
 void TcpConnectionImpl::writeCallback() {
     loop_->assertInLoopThread();
     extendLife();
+    if (writeBufferList_.empty() && !encryptsInUserSpace()) {
+        // The writing is enabled for the data that a source connection
+        // forwards through a pipe, see flushForwardPipe().
+        ioChannelPtr_->disableWriting();
+        if (status_ == ConnStatus::Disconnecting) {
+            socketPtr_->closeWrite();
+        }
+        notifyForwardSource();
+        return;
+    }
+    if (writePausedByRateLimit_) {
+        // The writing is enabled again by the timer of the rate limit.
+        ioChannelPtr_->disableWriting();
+        return;
+    }
+    if (!ioChannelPtr_->isEdgeTriggered()) {
+        writeBufferedData();
+    } else {
+        // In edge-triggered mode, no more write event is reported until the
+        // socket buffer is filled up, so keep writing as long as some progress
+        // is made.
+        writeCallbackLooping_ = true;
+        while (ioChannelPtr_->isWriting() && !writeBufferList_.empty() && !writePausedByRateLimit_) {
+            size_t bytesSent = bytesSent_.load(std::memory_order_relaxed);
+            size_t nodeNum = writeBufferList_.size();
+            ssize_t fileBytesToSend = writeBufferList_.front()->fileBytesToSend_;
+            writeBufferedData();
+            if (bytesSent == bytesSent_.load(std::memory_order_relaxed) && nodeNum == writeBufferList_.size() &&
+                (writeBufferList_.empty() || fileBytesToSend == writeBufferList_.front()->fileBytesToSend_)) {
+                break;
+            }
+        }
+        writeCallbackLooping_ = false;
+    }
+    if (writePausedByRateLimit_ && ioChannelPtr_->isWriting()) {
+        ioChannelPtr_->disableWriting();
+    }
+}
+void TcpConnectionImpl::writeBufferedData() {
     if (ioChannelPtr_->isWriting()) {
         if (tlsProviderPtr_) {
             bool sentAll = tlsProviderPtr_->sendBufferedData();
@@ -108,7 +417,7 @@ void TcpConnectionImpl::writeCallback() {
         auto writeBuffer_ = writeBufferList_.front();
         if (!writeBuffer_->isFile()) {
             // not a file
-            if (writeBuffer_->msgBuffer_->readableBytes() <= 0) {
+            if (writeBuffer_->readableBytes() <= 0) {
                 // finished sending
                 writeBufferList_.pop_front();
                 if (writeBufferList_.empty()) {
@@ -119,29 +428,15 @@ void TcpConnectionImpl::writeCallback() {
                     if (status_ == ConnStatus::Disconnecting) {
                         socketPtr_->closeWrite();
                     }
-                } else {
+                } else if (writeBufferList_.front()->isFile()) {
                     // send next
-                    // what if the next is not a file???
-                    auto fileNode = writeBufferList_.front();
-                    assert(fileNode->isFile());
-                    sendFileInLoop(fileNode);
+                    sendFileInLoop(writeBufferList_.front());
+                } else {
+                    writeMemoryNodes();
                 }
             } else {
                 // continue sending
-                auto n = writeInLoop(writeBuffer_->msgBuffer_->peek(), writeBuffer_->msgBuffer_->readableBytes());
-                if (n >= 0) {
-                    writeBuffer_->msgBuffer_->retrieve(n);
-                } else {
-                    if (errno != EWOULDBLOCK) {
-                        // TODO: any others?
-                        if (errno == EPIPE || errno == ECONNRESET) {
-                            LOG_TRACE << "EPIPE or ECONNRESET, errno=" << errno;
-                            return;
-                        }
-                        LOG_SYSERR << "Unexpected error(" << errno << ")";
-                        return;
-                    }
-                }
+                writeMemoryNodes();
             }
         } else {
             // is a file
@@ -160,23 +455,7 @@ void TcpConnectionImpl::writeCallback() {
                     // next is not a file
                     if (!writeBufferList_.front()->isFile()) {
                         // There is data to be sent in the buffer.
-                        auto n = writeInLoop(writeBufferList_.front()->msgBuffer_->peek(),
-                                             writeBufferList_.front()->msgBuffer_->readableBytes());
-                        if (n >= 0) {
-                            writeBufferList_.front()->msgBuffer_->retrieve(n);
-                        } else {
-                            if (errno != EWOULDBLOCK) {
-                                // TODO: any others?
-                                if (errno == EPIPE || errno == ECONNRESET) {
-                                    LOG_TRACE << "EPIPE or "
-                                                 "ECONNRESET, erron="
-                                              << errno;
-                                    return;
-                                }
-                                LOG_SYSERR << "Unexpected error(" << errno << ")";
-                                return;
-                            }
-                        }
+                        writeMemoryNodes();
                     } else {
                         // next is a file
                         sendFileInLoop(writeBufferList_.front());
@@ -191,18 +470,151 @@ void TcpConnectionImpl::writeCallback() {
                                                            tlsProviderPtr_->getBufferedData().readableBytes() == 0))) {
             shutdown();
         }
+        checkFlowControl();
+        notifyForwardSource();
     } else {
         LOG_SYSERR << "no writing but write callback called";
     }
 }
+void TcpConnectionImpl::writeMemoryNodes() {
+    assert(!writeBufferList_.empty() && !writeBufferList_.front()->isFile());
+    ssize_t n;
+    if (encryptsInUserSpace()) {
+        auto& node = writeBufferList_.front();
+        n = writeInLoop(node->peek(), node->readableBytes());
+        if (n > 0) {
+            node->retrieve(n);
+            subQueuedBytes(n);
+        }
+    } else {
+        struct iovec iov[IOV_MAX];
+        int flags = 0;
+        int iovcnt = gatherMemoryNodes(iov, IOV_MAX, &flags, nullptr);
+        n = iovcnt > 0 ? writevRaw(iov, iovcnt, flags) : 0;
+        retrieveMemoryNodes(n > 0 ? n : 0);
+    }
+    if (n < 0) {
+        if (errno != EWOULDBLOCK) {
+            // TODO: any others?
+            if (errno == EPIPE || errno == ECONNRESET) {
+                LOG_TRACE << "EPIPE or ECONNRESET, errno=" << errno;
+                return;
+            }
+            LOG_SYSERR << "Unexpected error(" << errno << ")";
+            return;
+        }
+    }
+}
+int TcpConnectionImpl::gatherMemoryNodes(struct iovec* iov, int maxCount, int* flags, BufferNode** last) {
+    // Gather the memory nodes at the front of the list into one writev().
+    // If a file follows them, e.g. the header of a response, they are sent
+    // with MSG_MORE to share packets with the beginning of the file.
+    int iovcnt = 0;
+    *flags = 0;
+    for (auto& node : writeBufferList_) {
+        if (node->isFile()) {
+            *flags = MSG_MORE;
+            break;
+        }
+        if (iovcnt == maxCount) {
+            break;
+        }
+        if (node->readableBytes() > 0) {
+            iov[iovcnt].iov_base = const_cast<char*>(node->peek());
+            iov[iovcnt].iov_len = node->readableBytes();
+            ++iovcnt;
+            if (last) {
+                *last = node.get();
+            }
+        }
+    }
+    return iovcnt;
+}
+void TcpConnectionImpl::retrieveMemoryNodes(size_t n) {
+    subQueuedBytes(n);
+    for (auto& node : writeBufferList_) {
+        if (n == 0 || node->isFile()) {
+            break;
+        }
+        size_t len = std::min(n, node->readableBytes());
+        node->retrieve(len);
+        n -= len;
+    }
+    // The last drained node is left to the next write event, which pops
+    // it and finishes writing if nothing follows.
+    while (writeBufferList_.size() > 1 && !writeBufferList_.front()->isFile() &&
+           writeBufferList_.front()->readableBytes() == 0) {
+        writeBufferList_.pop_front();
+    }
+}
+int TcpConnectionImpl::prepareSend(struct iovec* vec, int maxCount, int* flags, std::shared_ptr<void>* keepAlive) {
+    // Files and the data encrypted or limited in user space are written on
+    // write events.
+    if (!sendsByCompletion() || status_ == ConnStatus::Disconnected || writeBufferList_.empty() ||
+        writeBufferList_.front()->isFile()) {
+        return 0;
+    }
+    int count = gatherMemoryNodes(vec, maxCount, flags, &sendingTail_);
+    if (count == 0) {
+        return 0;
+    }
+    sendingBytes_ = 0;
+    for (int i = 0; i < count; ++i) {
+        sendingBytes_ += vec[i].iov_len;
+    }
+    *keepAlive = shared_from_this();
+    return count;
+}
+void TcpConnectionImpl::sendCompletion(ssize_t n) {
+    loop_->assertInLoopThread();
+    sendingTail_ = nullptr;
+    if (status_ == ConnStatus::Disconnected) {
+        return;
+    }
+    if (n < 0) {
+        errno = static_cast<int>(-n);
+        countWrite(-1, sendingBytes_);
+        if (errno == EAGAIN || errno == EINTR) {
+            // Sent again as the writing is still enabled.
+            return;
+        }
+        if (errno == EPIPE || errno == ECONNRESET) {
+            LOG_TRACE << "EPIPE or ECONNRESET, errno=" << errno;
+        } else {
+            LOG_SYSERR << "Unexpected error(" << errno << ")";
+        }
+        handleClose();
+        return;
+    }
+    extendLife();
+    countWrite(n, sendingBytes_);
+    addBytes(bytesSent_, n);
+    retrieveMemoryNodes(n);
+    if (writeBufferList_.front()->isFile()) {
+        // The memory nodes before a file or a stream have been sent, go on
+        // with it. It has no buffer to look at.
+        auto filePtr = writeBufferList_.front();
+        sendFileInLoop(filePtr);
+    } else if (writeBufferList_.size() == 1 && writeBufferList_.front()->readableBytes() == 0) {
+        // Finish writing like on a write event.
+        writeBufferedData();
+        return;
+    }
+    checkFlowControl();
+    notifyForwardSource();
+}
+void TcpConnectionImpl::enableEdgeTriggered() {
+    assert(status_ == ConnStatus::Connecting);
+    ioChannelPtr_->enableEdgeTriggered();
+}
 void TcpConnectionImpl::connectEstablished() {
     auto thisPtr = shared_from_this();
     loop_->runInLoop([thisPtr]() {
         LOG_TRACE << "connectEstablished";
         assert(thisPtr->status_ == ConnStatus::Connecting);
         thisPtr->ioChannelPtr_->tie(thisPtr);
-        thisPtr->ioChannelPtr_->enableReading();
         thisPtr->status_ = ConnStatus::Connected;
+        thisPtr->updateReading();
 
         if (thisPtr->tlsProviderPtr_)
             thisPtr->tlsProviderPtr_->startEncryption();
@@ -216,6 +628,7 @@ void TcpConnectionImpl::handleClose() {
     status_ = ConnStatus::Disconnected;
     ioChannelPtr_->disableAll();
     //  ioChannelPtr_->remove();
+    notifyForwardSourceOfClose();
     auto guardThis = shared_from_this();
     if (connectionCallback_)
         connectionCallback_(guardThis);
@@ -235,11 +648,471 @@ void TcpConnectionImpl::handleError() {
         LOG_ERROR << "[" << name_ << "] - SO_ERROR = " << err << " " << strerror_tl(err);
     }
 }
+void TcpConnectionImpl::stopRead() {
+    auto thisPtr = shared_from_this();
+    loop_->runInLoop([thisPtr]() {
+        thisPtr->readStopped_ = true;
+        thisPtr->updateReading();
+    });
+}
+void TcpConnectionImpl::startRead() {
+    auto thisPtr = shared_from_this();
+    loop_->runInLoop([thisPtr]() {
+        thisPtr->readStopped_ = false;
+        thisPtr->updateReading();
+    });
+}
+void TcpConnectionImpl::setFlowControl(size_t highMark, size_t lowMark) {
+    assert(highMark == 0 || lowMark < highMark);
+    auto thisPtr = shared_from_this();
+    loop_->runInLoop([thisPtr, highMark, lowMark]() {
+        thisPtr->flowHighMark_ = highMark;
+        thisPtr->flowLowMark_ = lowMark;
+        if (highMark == 0) {
+            thisPtr->readPausedByFlowControl_ = false;
+            thisPtr->updateReading();
+        } else {
+            thisPtr->checkFlowControl();
+        }
+    });
+}
+void TcpConnectionImpl::updateReading() {
+    loop_->assertInLoopThread();
+    if (status_ != ConnStatus::Connected && status_ != ConnStatus::Disconnecting) {
+        return;
+    }
+    bool reading = !readStopped_ && !readPausedByFlowControl_ && !readPausedByRateLimit_ &&
+                   !forwardPaused_.load(std::memory_order_relaxed);
+    if (reading == ioChannelPtr_->isReading()) {
+        return;
+    }
+    if (!reading) {
+        ioChannelPtr_->disableReading();
+        return;
+    }
+    ioChannelPtr_->enableReading();
+    if (ioChannelPtr_->isEdgeTriggered()) {
+        // The read events reported while reading is paused are dropped, read
+        // the data which may have arrived in the meantime.
+        auto thisPtr = shared_from_this();
+        loop_->queueInLoop([thisPtr]() {
+            if (thisPtr->ioChannelPtr_->isReading()) {
+                thisPtr->readCallback();
+            }
+        });
+    }
+}
+void TcpConnectionImpl::checkFlowControl() {
+    if (flowHighMark_ == 0) {
+        return;
+    }
+    size_t queued = queuedBytes();
+    if (tlsProviderPtr_) {
+        queued += tlsProviderPtr_->getBufferedData().readableBytes();
+    }
+    if (!readPausedByFlowControl_ && queued > flowHighMark_) {
+        LOG_TRACE << "pause reading, " << queued << " bytes queued";
+        readPausedByFlowControl_ = true;
+        updateReading();
+    } else if (readPausedByFlowControl_ && queued <= flowLowMark_) {
+        LOG_TRACE << "resume reading, " << queued << " bytes queued";
+        readPausedByFlowControl_ = false;
+        updateReading();
+    }
+}
+void TcpConnectionImpl::setRateLimit(size_t readBytesPerSecond, size_t writeBytesPerSecond, size_t burstBytes) {
+    auto thisPtr = shared_from_this();
+    loop_->runInLoop([thisPtr, readBytesPerSecond, writeBytesPerSecond, burstBytes]() {
+        thisPtr->readBucket_ =
+            readBytesPerSecond > 0 ? std::make_unique<TokenBucket>(readBytesPerSecond, burstBytes) : nullptr;
+        thisPtr->writeBucket_ =
+            writeBytesPerSecond > 0 ? std::make_unique<TokenBucket>(writeBytesPerSecond, burstBytes) : nullptr;
+        // A direction paused for the old limits is checked again right away.
+        if (thisPtr->readPausedByRateLimit_) {
+            thisPtr->resumeReadingAfterRateLimit();
+        }
+        if (thisPtr->writePausedByRateLimit_) {
+            thisPtr->resumeWritingAfterRateLimit();
+        }
+    });
+}
+static size_t availableTokens(TokenBucket* bucket, TokenBucket* serverBucket) {
+    size_t tokens = std::numeric_limits<size_t>::max();
+    if (bucket) {
+        tokens = bucket->available();
+    }
+    if (serverBucket) {
+        tokens = std::min(tokens, serverBucket->available());
+    }
+    return tokens;
+}
+// The time until a paused direction is resumed. Waiting for a hundredth of the
+// rate rather than for the next byte bounds the timers of a connection to
+// about 100 per second.
+static constexpr size_t kMinRateLimitChunk = 4 * 1024;
+static double refillDelay(TokenBucket* bucket, TokenBucket* serverBucket) {
+    double delay = 0.001;
+    for (auto b : {bucket, serverBucket}) {
+        if (b) {
+            delay = std::max(delay, b->delayUntil(std::max(b->rate() / 100, kMinRateLimitChunk)));
+        }
+    }
+    return delay;
+}
+size_t TcpConnectionImpl::readQuota() const {
+    return availableTokens(readBucket_.get(), serverReadBucket_.get());
+}
+size_t TcpConnectionImpl::writeQuota() const {
+    return availableTokens(writeBucket_.get(), serverWriteBucket_.get());
+}
+void TcpConnectionImpl::consumeReadQuota(size_t n) {
+    if (readBucket_) {
+        readBucket_->consume(n);
+    }
+    if (serverReadBucket_) {
+        serverReadBucket_->consume(n);
+    }
+}
+void TcpConnectionImpl::consumeWriteQuota(size_t n) {
+    if (writeBucket_) {
+        writeBucket_->consume(n);
+    }
+    if (serverWriteBucket_) {
+        serverWriteBucket_->consume(n);
+    }
+}
+void TcpConnectionImpl::pauseReadingForRateLimit() {
+    readPausedByRateLimit_ = true;
+    updateReading();
+    if (readRateTimerId_ != InvalidTimerId) {
+        return;
+    }
+    std::weak_ptr<TcpConnectionImpl> weakPtr = shared_from_this();
+    readRateTimerId_ = loop_->runAfter(refillDelay(readBucket_.get(), serverReadBucket_.get()), [weakPtr]() {
+        auto thisPtr = weakPtr.lock();
+        if (thisPtr) {
+            thisPtr->readRateTimerId_ = InvalidTimerId;
+            thisPtr->resumeReadingAfterRateLimit();
+        }
+    });
+}
+void TcpConnectionImpl::pauseWritingForRateLimit() {
+    // The writing is disabled by the write callback, as the callers of the
+    // writes enable it for the data left. A write cut by the limit doesn't
+    // fill up the socket, so the timer is needed in edge-triggered mode too.
+    writePausedByRateLimit_ = true;
+    if (writeRateTimerId_ != InvalidTimerId) {
+        return;
+    }
+    std::weak_ptr<TcpConnectionImpl> weakPtr = shared_from_this();
+    writeRateTimerId_ = loop_->runAfter(refillDelay(writeBucket_.get(), serverWriteBucket_.get()), [weakPtr]() {
+        auto thisPtr = weakPtr.lock();
+        if (thisPtr) {
+            thisPtr->writeRateTimerId_ = InvalidTimerId;
+            thisPtr->resumeWritingAfterRateLimit();
+        }
+    });
+}
+void TcpConnectionImpl::resumeReadingAfterRateLimit() {
+    if (readRateTimerId_ != InvalidTimerId) {
+        loop_->invalidateTimer(readRateTimerId_);
+        readRateTimerId_ = InvalidTimerId;
+    }
+    readPausedByRateLimit_ = false;
+    updateReading();
+}
+void TcpConnectionImpl::resumeWritingAfterRateLimit() {
+    if (writeRateTimerId_ != InvalidTimerId) {
+        loop_->invalidateTimer(writeRateTimerId_);
+        writeRateTimerId_ = InvalidTimerId;
+    }
+    writePausedByRateLimit_ = false;
+    if (status_ != ConnStatus::Connected && status_ != ConnStatus::Disconnecting) {
+        return;
+    }
+    if (!writeBufferList_.empty()) {
+        if (!ioChannelPtr_->isWriting()) {
+            ioChannelPtr_->enableWriting();
+        }
+        // No write event is reported for a socket that isn't full in
+        // edge-triggered mode.
+        if (ioChannelPtr_->isEdgeTriggered()) {
+            writeCallback();
+        }
+        return;
+    }
+    if (tlsProviderPtr_ && tlsProviderPtr_->getBufferedData().readableBytes() > 0) {
+        // E.g. the records of a handshake.
+        tlsProviderPtr_->sendBufferedData();
+        return;
+    }
+    notifyForwardSource();
+}
+void TcpConnectionImpl::forwardTo(const TcpConnectionPtr& target) {
+    auto thisPtr = shared_from_this();
+    auto targetPtr = std::static_pointer_cast<TcpConnectionImpl>(target);
+    loop_->runInLoop([thisPtr, targetPtr]() {
+        // The data left in the pipe belongs to the previous target.
+        thisPtr->stopForwarding();
+        thisPtr->forwardTarget_ = targetPtr;
+        if (!targetPtr) {
+            return;
+        }
+        targetPtr->loop_->runInLoop([thisPtr, targetPtr]() {
+            targetPtr->forwardSource_ = thisPtr;
+            if (targetPtr->status_ == ConnStatus::Disconnected) {
+                targetPtr->notifyForwardSourceOfClose();
+            }
+        });
+        // Forward the data received before.
+        if (thisPtr->getRecvBuffer()->readableBytes() > 0) {
+            thisPtr->deliverMessage(thisPtr->getRecvBuffer());
+        }
+        if (thisPtr->ringReadBuffer_.readableBytes() > 0) {
+            thisPtr->deliverRingMessage();
+        }
+    });
+}
+void TcpConnectionImpl::deliverMessage(MsgBuffer* buffer) {
+    auto target = forwardTarget_.lock();
+    if (!target) {
+        if (recvMsgCallback_)
+            recvMsgCallback_(shared_from_this(), buffer);
+        return;
+    }
+    target->send(buffer->peek(), buffer->readableBytes());
+    buffer->retrieveAll();
+    throttleForwarding(target);
+}
+void TcpConnectionImpl::deliverRingMessage() {
+    auto target = forwardTarget_.lock();
+    if (!target) {
+        if (recvRingMsgCallback_)
+            recvRingMsgCallback_(shared_from_this(), &ringReadBuffer_);
+        return;
+    }
+    struct iovec vec[2];
+    int count = ringReadBuffer_.peekSegments(vec);
+    std::vector<BufferSlice> slices;
+    for (int i = 0; i < count; ++i) {
+        slices.push_back({vec[i].iov_base, vec[i].iov_len});
+    }
+    target->send(slices);
+    ringReadBuffer_.retrieveAll();
+    throttleForwarding(target);
+}
+bool TcpConnectionImpl::canSpliceTo(const TcpConnectionImpl& target) const {
+    return !tlsProviderPtr_ && !target.encryptsInUserSpace() && target.loop_ == loop_;
+}
+bool TcpConnectionImpl::spliceToTarget(const std::shared_ptr<TcpConnectionImpl>& target) {
+    if (forwardPipe_.readFd < 0 && !PipePool::instance().acquire(forwardPipe_)) {
+        return false;
+    }
+    for (;;) {
+        if (forwardPipeBytes_ > 0 && !flushForwardPipe(target)) {
+            return true;
+        }
+        // The pipe is empty here, so it can take a whole chunk.
+        size_t chunkSize = kSpliceChunkSize;
+        if (readRateLimited()) {
+            chunkSize = std::min(chunkSize, readQuota());
+            if (chunkSize == 0) {
+                releaseForwardPipe();
+                pauseReadingForRateLimit();
+                return true;
+            }
+        }
+        ssize_t n = ::splice(socketPtr_->fd(), nullptr, forwardPipe_.writeFd, nullptr, chunkSize,
+                             SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+        if (n > 0) {
+            extendLife();
+            addBytes(bytesReceived_, n);
+            countRead();
+            if (readRateLimited()) {
+                consumeReadQuota(n);
+            }
+            forwardPipeBytes_ += n;
+            continue;
+        }
+        if (n == 0) {
+            // socket closed by peer
+            releaseForwardPipe();
+            handleClose();
+            return true;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN) {
+            // Only hold a pipe while some data is in it.
+            releaseForwardPipe();
+            return true;
+        }
+        if (errno == EPIPE || errno == ECONNRESET) {
+            LOG_TRACE << "EPIPE or ECONNRESET, errno=" << errno << " fd=" << socketPtr_->fd();
+            return true;
+        }
+        LOG_SYSERR << "splice from socket error";
+        releaseForwardPipe();
+        handleClose();
+        return true;
+    }
+}
+bool TcpConnectionImpl::flushForwardPipe(const std::shared_ptr<TcpConnectionImpl>& target) {
+    if (!target->writeBufferList_.empty()) {
+        // Wait for the data queued in the target, which is written first.
+        pauseForwarding();
+        return false;
+    }
+    while (forwardPipeBytes_ > 0) {
+        size_t len = forwardPipeBytes_;
+        if (target->writeRateLimited() && len > target->writeQuota()) {
+            // Resumed by the target when its buckets are refilled.
+            target->pauseWritingForRateLimit();
+            len = target->writeQuota();
+            if (len == 0) {
+                pauseForwarding();
+                return false;
+            }
+        }
+        ssize_t n = ::splice(forwardPipe_.readFd, nullptr, target->socketPtr_->fd(), nullptr, len,
+                             SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+        target->countWrite(n, len);
+        if (n > 0) {
+            forwardPipeBytes_ -= n;
+            addBytes(target->bytesSent_, n);
+            if (target->writeRateLimited()) {
+                target->consumeWriteQuota(n);
+            }
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno != EAGAIN) {
+            if (errno == EPIPE || errno == ECONNRESET) {
+                LOG_TRACE << "EPIPE or ECONNRESET, errno=" << errno << " fd=" << target->socketPtr_->fd();
+            } else {
+                LOG_SYSERR << "splice to socket error";
+            }
+            // The target takes no more data, so waiting for it would keep
+            // this connection paused forever.
+            stopForwarding();
+            return false;
+        }
+        pauseForwarding();
+        if (!target->ioChannelPtr_->isWriting()) {
+            target->ioChannelPtr_->enableWriting();
+        }
+        return false;
+    }
+    target->extendLife();
+    return true;
+}
+void TcpConnectionImpl::pauseForwarding() {
+    if (!forwardPaused_.load(std::memory_order_relaxed)) {
+        forwardPaused_.store(true, std::memory_order_release);
+        updateReading();
+    }
+}
+void TcpConnectionImpl::throttleForwarding(const std::shared_ptr<TcpConnectionImpl>& target) {
+    if (target->queuedBytes() <= kForwardHighMark) {
+        return;
+    }
+    pauseForwarding();
+    // The target may have drained its queue in its own thread before the
+    // flag was set, without resuming the forwarding, so look at the queue
+    // again. The fence pairs with the one in notifyForwardSource(): either
+    // the target sees the flag or the source sees the drained queue.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (target->queuedBytes() <= kForwardLowMark) {
+        resumeForwarding();
+    }
+}
+void TcpConnectionImpl::resumeForwarding() {
+    loop_->assertInLoopThread();
+    if (!forwardPaused_.load(std::memory_order_relaxed)) {
+        return;
+    }
+    auto target = forwardTarget_.lock();
+    if (target) {
+        if (forwardPipeBytes_ > 0) {
+            forwardPaused_.store(false, std::memory_order_relaxed);
+            if (!flushForwardPipe(target)) {
+                return;
+            }
+        } else if (target->queuedBytes() > kForwardLowMark) {
+            return;
+        }
+    }
+    forwardPaused_.store(false, std::memory_order_relaxed);
+    updateReading();
+}
+void TcpConnectionImpl::notifyForwardSource() {
+    if (queuedBytes() > kForwardLowMark) {
+        return;
+    }
+    auto source = forwardSource_.lock();
+    if (!source) {
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!source->forwardPaused_.load(std::memory_order_acquire)) {
+        return;
+    }
+    source->loop_->runInLoop([source]() {
+        source->resumeForwarding();
+    });
+}
+void TcpConnectionImpl::notifyForwardSourceOfClose() {
+    auto source = forwardSource_.lock();
+    if (!source) {
+        return;
+    }
+    forwardSource_.reset();
+    // Only compared with the target of the source, which may have changed.
+    const TcpConnectionImpl* target = this;
+    source->loop_->runInLoop([source, target]() {
+        auto current = source->forwardTarget_.lock();
+        if (!current || current.get() == target) {
+            source->stopForwarding();
+        }
+    });
+}
+void TcpConnectionImpl::stopForwarding() {
+    // The data left in the pipe is dropped with it. The data received from
+    // now on is passed to the message callback, as after forwardTo(nullptr).
+    releaseForwardPipe();
+    forwardTarget_.reset();
+    if (forwardPaused_.load(std::memory_order_relaxed)) {
+        forwardPaused_.store(false, std::memory_order_relaxed);
+        updateReading();
+    }
+}
+void TcpConnectionImpl::releaseForwardPipe() {
+    if (forwardPipe_.readFd < 0) {
+        return;
+    }
+    PipePool::instance().release(forwardPipe_, forwardPipeBytes_ == 0);
+    forwardPipe_ = PipePool::Pipe();
+    forwardPipeBytes_ = 0;
+}
 void TcpConnectionImpl::setTcpNoDelay(bool on) {
     socketPtr_->setTcpNoDelay(on);
 }
 void TcpConnectionImpl::connectDestroyed() {
     loop_->assertInLoopThread();
+    releaseForwardPipe();
+    if (readBufferTimerId_ != InvalidTimerId) {
+        loop_->invalidateTimer(readBufferTimerId_);
+        readBufferTimerId_ = InvalidTimerId;
+    }
+    for (auto timerId : {&readRateTimerId_, &writeRateTimerId_}) {
+        if (*timerId != InvalidTimerId) {
+            loop_->invalidateTimer(*timerId);
+            *timerId = InvalidTimerId;
+        }
+    }
     if (status_ == ConnStatus::Connected) {
         status_ = ConnStatus::Disconnected;
         ioChannelPtr_->disableAll();
@@ -260,41 +1133,236 @@ void TcpConnectionImpl::shutdown() {
                     thisPtr->closeOnEmpty_ = true;
                     return;
                 }
-                thisPtr->tlsProviderPtr_->close();
-            }
-            if (thisPtr->tlsProviderPtr_ == nullptr && thisPtr->writeBufferList_.size() != 0) {
-                thisPtr->closeOnEmpty_ = true;
+                thisPtr->tlsProviderPtr_->close();
+            }
+            if (thisPtr->tlsProviderPtr_ == nullptr && thisPtr->writeBufferList_.size() != 0) {
+                thisPtr->closeOnEmpty_ = true;
+                return;
+            }
+            thisPtr->status_ = ConnStatus::Disconnecting;
+            if (!thisPtr->ioChannelPtr_->isWriting()) {
+                thisPtr->socketPtr_->closeWrite();
+            }
+        }
+    });
+}
+
+void TcpConnectionImpl::forceClose() {
+    auto thisPtr = shared_from_this();
+    loop_->runInLoop([thisPtr]() {
+        if (thisPtr->status_ == ConnStatus::Connected || thisPtr->status_ == ConnStatus::Disconnecting) {
+            thisPtr->status_ = ConnStatus::Disconnecting;
+            thisPtr->handleClose();
+        }
+    });
+}
+void TcpConnectionImpl::sendInLoop(const void* buffer, size_t length) {
+    loop_->assertInLoopThread();
+    if (status_ != ConnStatus::Connected) {
+        LOG_WARN << "Connection is not connected,give up sending";
+        return;
+    }
+    extendLife();
+    if (autoCork_ && !ioChannelPtr_->isWriting()) {
+        if (length <= kMaxCorkedSendSize) {
+            corkInLoop(buffer, length);
+            return;
+        }
+        // A large send is written right away, after the data held.
+        flushInLoop();
+    }
+    size_t remainLen = length;
+    ssize_t sendLen = 0;
+    // With completion-based sends, the data is queued and sent by the poller
+    // together with its wait.
+    if (!ioChannelPtr_->isWriting() && writeBufferList_.empty() && !sendsByCompletion()) {
+        // send directly
+        sendLen = writeInLoop(buffer, length);
+        if (sendLen < 0) {
+            // error
+            if (errno != EWOULDBLOCK) {
+                if (errno == EPIPE || errno == ECONNRESET)  // TODO: any others?
+                {
+                    LOG_TRACE << "EPIPE or ECONNRESET, errno=" << errno;
+                    return;
+                }
+                LOG_SYSERR << "Unexpected error(" << errno << ")";
+                return;
+            }
+            sendLen = 0;
+        }
+        remainLen -= sendLen;
+    }
+    if (remainLen > 0 && status_ == ConnStatus::Connected) {
+        appendToWriteBuffer(static_cast<const char*>(buffer) + sendLen, remainLen);
+    }
+}
+void TcpConnectionImpl::sendInLoop(const BufferSlice* slices, size_t count) {
+    loop_->assertInLoopThread();
+    if (status_ != ConnStatus::Connected) {
+        LOG_WARN << "Connection is not connected,give up sending";
+        return;
+    }
+    if (encryptsInUserSpace() || autoCork_ || ioChannelPtr_->isWriting() || !writeBufferList_.empty() ||
+        sendsByCompletion()) {
+        // The slices are encrypted, held or queued one by one anyway.
+        for (size_t i = 0; i < count; ++i) {
+            sendInLoop(slices[i].data, slices[i].length);
+        }
+        return;
+    }
+    extendLife();
+    // send directly
+    size_t index = 0;
+    size_t offset = 0;
+    while (index < count) {
+        struct iovec iov[IOV_MAX];
+        int iovcnt = 0;
+        size_t total = 0;
+        for (size_t i = index; i < count && iovcnt < IOV_MAX; ++i) {
+            size_t skip = i == index ? offset : 0;
+            if (slices[i].length > skip) {
+                iov[iovcnt].iov_base = const_cast<char*>(static_cast<const char*>(slices[i].data) + skip);
+                iov[iovcnt].iov_len = slices[i].length - skip;
+                total += iov[iovcnt].iov_len;
+                ++iovcnt;
+            }
+        }
+        if (iovcnt == 0) {
+            return;
+        }
+        ssize_t sendLen = writevRaw(iov, iovcnt);
+        if (sendLen < 0) {
+            // error
+            if (errno != EWOULDBLOCK) {
+                if (errno == EPIPE || errno == ECONNRESET)  // TODO: any others?
+                {
+                    LOG_TRACE << "EPIPE or ECONNRESET, errno=" << errno;
+                    return;
+                }
+                LOG_SYSERR << "Unexpected error(" << errno << ")";
                 return;
             }
-            thisPtr->status_ = ConnStatus::Disconnecting;
-            if (!thisPtr->ioChannelPtr_->isWriting()) {
-                thisPtr->socketPtr_->closeWrite();
-            }
+            sendLen = 0;
         }
-    });
+        size_t remaining = sendLen;
+        while (index < count && remaining >= slices[index].length - offset) {
+            remaining -= slices[index].length - offset;
+            offset = 0;
+            ++index;
+        }
+        offset += remaining;
+        if (static_cast<size_t>(sendLen) < total) {
+            break;
+        }
+    }
+    // Queue the rest, the first slice may be partially sent.
+    for (; index < count && status_ == ConnStatus::Connected; ++index) {
+        if (slices[index].length > offset) {
+            appendToWriteBuffer(static_cast<const char*>(slices[index].data) + offset, slices[index].length - offset);
+        }
+        offset = 0;
+    }
 }
-
-void TcpConnectionImpl::forceClose() {
+void TcpConnectionImpl::appendToWriteBuffer(const void* buffer, size_t length) {
+    if (writeBufferList_.empty() || writeBufferList_.back()->isFile() || writeBufferList_.back()->isShared() ||
+        writeBufferList_.back().get() == sendingTail_) {
+        writeBufferList_.push_back(newMemoryNode());
+    }
+    writeBufferList_.back()->msgBuffer_->append(static_cast<const char*>(buffer), length);
+    addQueuedBytes(length);
+    if (!ioChannelPtr_->isWriting())
+        ioChannelPtr_->enableWriting();
+    if (highWaterMarkCallback_ && writeBufferList_.back()->readableBytes() > highWaterMarkLen_) {
+        highWaterMarkCallback_(shared_from_this(), writeBufferList_.back()->readableBytes());
+    }
+    if (highWaterMarkCallback_ && tlsProviderPtr_ &&
+        tlsProviderPtr_->getBufferedData().readableBytes() > highWaterMarkLen_) {
+        highWaterMarkCallback_(shared_from_this(), tlsProviderPtr_->getBufferedData().readableBytes());
+    }
+    checkFlowControl();
+}
+// The data held by the auto cork is queued without enabling the writing, and
+// written by flushInLoop() at the end of the loop iteration, which enables the
+// writing only for what the socket doesn't take.
+void TcpConnectionImpl::corkInLoop(const void* buffer, size_t length) {
+    if (writeBufferList_.empty() || writeBufferList_.back()->isFile() || writeBufferList_.back()->isShared() ||
+        writeBufferList_.back().get() == sendingTail_) {
+        writeBufferList_.push_back(newMemoryNode());
+    }
+    writeBufferList_.back()->msgBuffer_->append(static_cast<const char*>(buffer), length);
+    addQueuedBytes(length);
+    scheduleFlush();
+}
+void TcpConnectionImpl::scheduleFlush() {
+    if (flushScheduled_) {
+        return;
+    }
+    flushScheduled_ = true;
+    // The functions queued in the loop thread run after the I/O events of
+    // the current iteration.
     auto thisPtr = shared_from_this();
-    loop_->runInLoop([thisPtr]() {
-        if (thisPtr->status_ == ConnStatus::Connected || thisPtr->status_ == ConnStatus::Disconnecting) {
-            thisPtr->status_ = ConnStatus::Disconnecting;
-            thisPtr->handleClose();
+    loop_->queueInLoop([thisPtr]() {
+        thisPtr->flushInLoop();
+    });
+}
+void TcpConnectionImpl::flushInLoop() {
+    loop_->assertInLoopThread();
+    flushScheduled_ = false;
+    // The write events send the rest once the writing is enabled.
+    if (status_ == ConnStatus::Disconnected || ioChannelPtr_->isWriting() || writeBufferList_.empty()) {
+        return;
+    }
+    // With completion-based sends, the poller sends the data once the writing
+    // is enabled, together with its wait.
+    while (!writeBufferList_.empty() && !writeBufferList_.front()->isFile() && !sendsByCompletion()) {
+        writeMemoryNodes();
+        // The drained nodes before a file are popped by writeMemoryNodes().
+        if (writeBufferList_.front()->isFile() || writeBufferList_.front()->readableBytes() > 0) {
+            break;
+        }
+        writeBufferList_.pop_front();
+    }
+    // Like a send written right away, no write complete callback is called
+    // if the socket takes all the data.
+    if (writeBufferList_.empty()) {
+        if (closeOnEmpty_) {
+            shutdown();
         }
+    } else if (writeBufferList_.front()->isFile()) {
+        sendFileInLoop(writeBufferList_.front());
+    } else {
+        ioChannelPtr_->enableWriting();
+    }
+    checkFlowControl();
+    notifyForwardSource();
+}
+void TcpConnectionImpl::flush() {
+    if (canSendDirectly()) {
+        flushInLoop();
+        return;
+    }
+    queueSend([this]() {
+        flushInLoop();
     });
 }
-void TcpConnectionImpl::sendInLoop(const void* buffer, size_t length) {
+void TcpConnectionImpl::sendSharedInLoop(const BufferNodePtr& node) {
     loop_->assertInLoopThread();
     if (status_ != ConnStatus::Connected) {
         LOG_WARN << "Connection is not connected,give up sending";
         return;
     }
     extendLife();
-    size_t remainLen = length;
-    ssize_t sendLen = 0;
-    if (!ioChannelPtr_->isWriting() && writeBufferList_.empty()) {
+    if (autoCork_ && !ioChannelPtr_->isWriting()) {
+        // Held without being copied.
+        writeBufferList_.push_back(node);
+        addQueuedBytes(node->readableBytes());
+        scheduleFlush();
+        return;
+    }
+    if (!ioChannelPtr_->isWriting() && writeBufferList_.empty() && !sendsByCompletion()) {
         // send directly
-        sendLen = writeInLoop(buffer, length);
+        ssize_t sendLen = writeInLoop(node->peek(), node->readableBytes());
         if (sendLen < 0) {
             // error
             if (errno != EWOULDBLOCK) {
@@ -308,237 +1376,192 @@ void TcpConnectionImpl::sendInLoop(const void* buffer, size_t length) {
             }
             sendLen = 0;
         }
-        remainLen -= sendLen;
+        node->retrieve(sendLen);
     }
-    if (remainLen > 0 && status_ == ConnStatus::Connected) {
-        if (writeBufferList_.empty()) {
-            BufferNodePtr node = std::make_shared<BufferNode>();
-            node->msgBuffer_ = std::make_shared<MsgBuffer>();
-            writeBufferList_.push_back(std::move(node));
-        } else if (writeBufferList_.back()->isFile()) {
-            BufferNodePtr node = std::make_shared<BufferNode>();
-            node->msgBuffer_ = std::make_shared<MsgBuffer>();
-            writeBufferList_.push_back(std::move(node));
-        }
-        writeBufferList_.back()->msgBuffer_->append(static_cast<const char*>(buffer) + sendLen, remainLen);
-        if (!ioChannelPtr_->isWriting())
-            ioChannelPtr_->enableWriting();
-        if (highWaterMarkCallback_ && writeBufferList_.back()->msgBuffer_->readableBytes() > highWaterMarkLen_) {
-            highWaterMarkCallback_(shared_from_this(), writeBufferList_.back()->msgBuffer_->readableBytes());
-        }
-        if (highWaterMarkCallback_ && tlsProviderPtr_ &&
-            tlsProviderPtr_->getBufferedData().readableBytes() > highWaterMarkLen_) {
-            highWaterMarkCallback_(shared_from_this(), tlsProviderPtr_->getBufferedData().readableBytes());
-        }
+    if (node->readableBytes() == 0 || status_ != ConnStatus::Connected) {
+        return;
     }
+    // Queue the reference to the rest of the buffer instead of copying it.
+    writeBufferList_.push_back(node);
+    addQueuedBytes(node->readableBytes());
+    if (!ioChannelPtr_->isWriting())
+        ioChannelPtr_->enableWriting();
+    if (highWaterMarkCallback_ && node->readableBytes() > highWaterMarkLen_) {
+        highWaterMarkCallback_(shared_from_this(), node->readableBytes());
+    }
+    checkFlowControl();
 }
-// The order of data sending should be same as the order of calls of send()
+// The data that can't be written right away is copied, as it always has been,
+// so the buffer may be reused once the call has been handled in the loop.
 void TcpConnectionImpl::send(const std::shared_ptr<std::string>& msgPtr) {
-    if (loop_->isInLoopThread()) {
-        std::lock_guard<std::mutex> guard(sendNumMutex_);
-        if (sendNum_ == 0) {
-            sendInLoop(msgPtr->data(), msgPtr->length());
-        } else {
-            ++sendNum_;
-            auto thisPtr = shared_from_this();
-            loop_->queueInLoop([thisPtr, msgPtr]() {
-                thisPtr->sendInLoop(msgPtr->data(), msgPtr->length());
-                std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
-                --thisPtr->sendNum_;
-            });
-        }
-    } else {
-        auto thisPtr = shared_from_this();
-        std::lock_guard<std::mutex> guard(sendNumMutex_);
-        ++sendNum_;
-        loop_->queueInLoop([thisPtr, msgPtr]() {
-            thisPtr->sendInLoop(msgPtr->data(), msgPtr->length());
-            std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
-            --thisPtr->sendNum_;
-        });
+    if (canSendDirectly()) {
+        sendInLoop(msgPtr->data(), msgPtr->length());
+        return;
     }
+    queueSend([this, msgPtr]() {
+        sendInLoop(msgPtr->data(), msgPtr->length());
+    });
 }
-// The order of data sending should be same as the order of calls of send()
 void TcpConnectionImpl::send(const std::shared_ptr<MsgBuffer>& msgPtr) {
-    if (loop_->isInLoopThread()) {
-        std::lock_guard<std::mutex> guard(sendNumMutex_);
-        if (sendNum_ == 0) {
-            sendInLoop(msgPtr->peek(), msgPtr->readableBytes());
-        } else {
-            ++sendNum_;
-            auto thisPtr = shared_from_this();
-            loop_->queueInLoop([thisPtr, msgPtr]() {
-                thisPtr->sendInLoop(msgPtr->peek(), msgPtr->readableBytes());
-                std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
-                --thisPtr->sendNum_;
-            });
-        }
-    } else {
+    if (canSendDirectly()) {
+        sendInLoop(msgPtr->peek(), msgPtr->readableBytes());
+        return;
+    }
+    queueSend([this, msgPtr]() {
+        sendInLoop(msgPtr->peek(), msgPtr->readableBytes());
+    });
+}
+void TcpConnectionImpl::send(const std::shared_ptr<std::string>& msgPtr, const SendCompleteCallback& cb) {
+    sendShared(newSharedNode(msgPtr, msgPtr->data(), msgPtr->length(), callInLoop(cb)));
+}
+void TcpConnectionImpl::send(const std::shared_ptr<MsgBuffer>& msgPtr, const SendCompleteCallback& cb) {
+    sendShared(newSharedNode(msgPtr, msgPtr->peek(), msgPtr->readableBytes(), callInLoop(cb)));
+}
+// The last reference to a node may be dropped in any thread, e.g. by a task
+// of the outbound queue destroyed with the loop, so the callback is run in
+// the loop rather than by the destructor of the node.
+SendCompleteCallback TcpConnectionImpl::callInLoop(const SendCompleteCallback& cb) const {
+    if (!cb) {
+        return nullptr;
+    }
+    EventLoop* loop = loop_;
+    return [loop, cb](bool sent) {
+        loop->runInLoop([cb, sent]() {
+            cb(sent);
+        });
+    };
+}
+// The nodes and their control blocks are allocated together from the buffer
+// pool of the thread, which is the event loop of the connection in most cases.
+TcpConnectionImpl::BufferNodePtr TcpConnectionImpl::newBufferNode() {
+    return std::allocate_shared<BufferNode>(PoolAllocator<BufferNode>());
+}
+TcpConnectionImpl::BufferNodePtr TcpConnectionImpl::newMemoryNode() {
+    auto node = newBufferNode();
+    node->msgBuffer_ = BufferPool::acquireBuffer();
+    return node;
+}
+TcpConnectionImpl::BufferNodePtr TcpConnectionImpl::newSharedNode(std::shared_ptr<const void> holder,
+                                                                  const char* data, size_t length,
+                                                                  const SendCompleteCallback& cb) {
+    auto node = newBufferNode();
+    node->sharedData_ = std::move(holder);
+    node->data_ = data;
+    node->dataLength_ = length;
+    node->sendCompleteCallback_ = cb;
+    return node;
+}
+// The order of data sending should be same as the order of calls of send().
+// A send in the thread of the event loop is done directly unless some sends
+// from other threads are still queued, otherwise it is put into the outbound
+// queue, which is drained by one task in the event loop.
+bool TcpConnectionImpl::canSendDirectly() const {
+    return loop_->isInLoopThread() && pendingSendNum_.load(std::memory_order_acquire) == 0;
+}
+// Return true if the caller has to schedule a drain of the outbound queue,
+// which is the case for the first send queued after the last drain started.
+bool TcpConnectionImpl::enqueueSend(Task&& task) {
+    pendingSendNum_.fetch_add(1, std::memory_order_acq_rel);
+    outboundQueue_.enqueue(std::move(task));
+    return !drainScheduled_.exchange(true, std::memory_order_acq_rel);
+}
+void TcpConnectionImpl::queueSend(Task&& task) {
+    if (enqueueSend(std::move(task))) {
         auto thisPtr = shared_from_this();
-        std::lock_guard<std::mutex> guard(sendNumMutex_);
-        ++sendNum_;
-        loop_->queueInLoop([thisPtr, msgPtr]() {
-            thisPtr->sendInLoop(msgPtr->peek(), msgPtr->readableBytes());
-            std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
-            --thisPtr->sendNum_;
+        loop_->queueInLoop([thisPtr]() {
+            thisPtr->drainOutboundQueue();
         });
     }
 }
+void TcpConnectionImpl::drainOutboundQueue() {
+    loop_->assertInLoopThread();
+    // Reset the flag before draining, so a send queued after the last dequeue
+    // schedules another drain.
+    drainScheduled_.exchange(false, std::memory_order_acq_rel);
+    Task task;
+    while (outboundQueue_.dequeue(task)) {
+        task();
+        task.reset();
+        pendingSendNum_.fetch_sub(1, std::memory_order_acq_rel);
+    }
+}
+void TcpConnectionImpl::sendShared(BufferNodePtr&& node) {
+    if (canSendDirectly()) {
+        sendSharedInLoop(node);
+        return;
+    }
+    queueSend([this, node = std::move(node)]() {
+        sendSharedInLoop(node);
+    });
+}
 void TcpConnectionImpl::send(const char* msg, size_t len) {
-    if (loop_->isInLoopThread()) {
-        std::lock_guard<std::mutex> guard(sendNumMutex_);
-        if (sendNum_ == 0) {
-            sendInLoop(msg, len);
-        } else {
-            ++sendNum_;
-            auto buffer = std::make_shared<std::string>(msg, len);
-            auto thisPtr = shared_from_this();
-            loop_->queueInLoop([thisPtr, buffer]() {
-                thisPtr->sendInLoop(buffer->data(), buffer->length());
-                std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
-                --thisPtr->sendNum_;
-            });
-        }
-    } else {
-        auto buffer = std::make_shared<std::string>(msg, len);
-        auto thisPtr = shared_from_this();
-        std::lock_guard<std::mutex> guard(sendNumMutex_);
-        ++sendNum_;
-        loop_->queueInLoop([thisPtr, buffer]() {
-            thisPtr->sendInLoop(buffer->data(), buffer->length());
-            std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
-            --thisPtr->sendNum_;
-        });
+    if (canSendDirectly()) {
+        sendInLoop(msg, len);
+        return;
     }
+    queueSend([this, buffer = std::string(msg, len)]() {
+        sendInLoop(buffer.data(), buffer.length());
+    });
 }
 void TcpConnectionImpl::send(const void* msg, size_t len) {
-    if (loop_->isInLoopThread()) {
-        std::lock_guard<std::mutex> guard(sendNumMutex_);
-        if (sendNum_ == 0) {
-            sendInLoop(msg, len);
-        } else {
-            ++sendNum_;
-            auto buffer = std::make_shared<std::string>(static_cast<const char*>(msg), len);
-            auto thisPtr = shared_from_this();
-            loop_->queueInLoop([thisPtr, buffer]() {
-                thisPtr->sendInLoop(buffer->data(), buffer->length());
-                std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
-                --thisPtr->sendNum_;
-            });
-        }
-    } else {
-        auto buffer = std::make_shared<std::string>(static_cast<const char*>(msg), len);
-        auto thisPtr = shared_from_this();
-        std::lock_guard<std::mutex> guard(sendNumMutex_);
-        ++sendNum_;
-        loop_->queueInLoop([thisPtr, buffer]() {
-            thisPtr->sendInLoop(buffer->data(), buffer->length());
-            std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
-            --thisPtr->sendNum_;
-        });
-    }
+    send(static_cast<const char*>(msg), len);
 }
 void TcpConnectionImpl::send(const std::string& msg) {
-    if (loop_->isInLoopThread()) {
-        std::lock_guard<std::mutex> guard(sendNumMutex_);
-        if (sendNum_ == 0) {
-            sendInLoop(msg.data(), msg.length());
-        } else {
-            ++sendNum_;
-            auto thisPtr = shared_from_this();
-            loop_->queueInLoop([thisPtr, msg]() {
-                thisPtr->sendInLoop(msg.data(), msg.length());
-                std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
-                --thisPtr->sendNum_;
-            });
-        }
-    } else {
-        auto thisPtr = shared_from_this();
-        std::lock_guard<std::mutex> guard(sendNumMutex_);
-        ++sendNum_;
-        loop_->queueInLoop([thisPtr, msg]() {
-            thisPtr->sendInLoop(msg.data(), msg.length());
-            std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
-            --thisPtr->sendNum_;
-        });
+    if (canSendDirectly()) {
+        sendInLoop(msg.data(), msg.length());
+        return;
     }
+    queueSend([this, msg]() {
+        sendInLoop(msg.data(), msg.length());
+    });
 }
 void TcpConnectionImpl::send(std::string&& msg) {
-    if (loop_->isInLoopThread()) {
-        std::lock_guard<std::mutex> guard(sendNumMutex_);
-        if (sendNum_ == 0) {
-            sendInLoop(msg.data(), msg.length());
-        } else {
-            auto thisPtr = shared_from_this();
-            ++sendNum_;
-            loop_->queueInLoop([thisPtr, msg = std::move(msg)]() {
-                thisPtr->sendInLoop(msg.data(), msg.length());
-                std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
-                --thisPtr->sendNum_;
-            });
-        }
-    } else {
-        auto thisPtr = shared_from_this();
-        std::lock_guard<std::mutex> guard(sendNumMutex_);
-        ++sendNum_;
-        loop_->queueInLoop([thisPtr, msg = std::move(msg)]() {
-            thisPtr->sendInLoop(msg.data(), msg.length());
-            std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
-            --thisPtr->sendNum_;
-        });
+    if (canSendDirectly()) {
+        sendInLoop(msg.data(), msg.length());
+        return;
     }
+    queueSend([this, msg = std::move(msg)]() {
+        sendInLoop(msg.data(), msg.length());
+    });
 }
 
 void TcpConnectionImpl::send(const MsgBuffer& buffer) {
-    if (loop_->isInLoopThread()) {
-        std::lock_guard<std::mutex> guard(sendNumMutex_);
-        if (sendNum_ == 0) {
-            sendInLoop(buffer.peek(), buffer.readableBytes());
-        } else {
-            ++sendNum_;
-            auto thisPtr = shared_from_this();
-            loop_->queueInLoop([thisPtr, buffer]() {
-                thisPtr->sendInLoop(buffer.peek(), buffer.readableBytes());
-                std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
-                --thisPtr->sendNum_;
-            });
-        }
-    } else {
-        auto thisPtr = shared_from_this();
-        std::lock_guard<std::mutex> guard(sendNumMutex_);
-        ++sendNum_;
-        loop_->queueInLoop([thisPtr, buffer]() {
-            thisPtr->sendInLoop(buffer.peek(), buffer.readableBytes());
-            std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
-            --thisPtr->sendNum_;
-        });
+    if (canSendDirectly()) {
+        sendInLoop(buffer.peek(), buffer.readableBytes());
+        return;
     }
+    queueSend([this, msg = std::string(buffer.peek(), buffer.readableBytes())]() {
+        sendInLoop(msg.data(), msg.length());
+    });
 }
 
 void TcpConnectionImpl::send(MsgBuffer&& buffer) {
-    if (loop_->isInLoopThread()) {
-        std::lock_guard<std::mutex> guard(sendNumMutex_);
-        if (sendNum_ == 0) {
-            sendInLoop(buffer.peek(), buffer.readableBytes());
-        } else {
-            ++sendNum_;
-            auto thisPtr = shared_from_this();
-            loop_->queueInLoop([thisPtr, buffer = std::move(buffer)]() {
-                thisPtr->sendInLoop(buffer.peek(), buffer.readableBytes());
-                std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
-                --thisPtr->sendNum_;
-            });
-        }
-    } else {
-        auto thisPtr = shared_from_this();
-        std::lock_guard<std::mutex> guard(sendNumMutex_);
-        ++sendNum_;
-        loop_->queueInLoop([thisPtr, buffer = std::move(buffer)]() {
-            thisPtr->sendInLoop(buffer.peek(), buffer.readableBytes());
-            std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
-            --thisPtr->sendNum_;
-        });
+    if (canSendDirectly()) {
+        sendInLoop(buffer.peek(), buffer.readableBytes());
+        return;
+    }
+    queueSend([this, buffer = std::move(buffer)]() {
+        sendInLoop(buffer.peek(), buffer.readableBytes());
+    });
+}
+void TcpConnectionImpl::send(const std::vector<BufferSlice>& slices) {
+    if (canSendDirectly()) {
+        sendInLoop(slices.data(), slices.size());
+        return;
+    }
+    // The slices must be copied before the method returns.
+    size_t length = 0;
+    for (auto& slice : slices) {
+        length += slice.length;
     }
+    std::string buffer;
+    buffer.reserve(length);
+    for (auto& slice : slices) {
+        buffer.append(static_cast<const char*>(slice.data), slice.length);
+    }
+    queueSend([this, buffer = std::move(buffer)]() {
+        sendInLoop(buffer.data(), buffer.length());
+    });
 }
 void TcpConnectionImpl::sendJson(const nlohmann::json& json) {
     std::string str = json.dump();
@@ -578,107 +1601,70 @@ void TcpConnectionImpl::sendFile(const wchar_t* fileName, size_t offset, size_t
 void TcpConnectionImpl::sendFile(int sfd, size_t offset, size_t length) {
     assert(length > 0);
     assert(sfd >= 0);
-    BufferNodePtr node = std::make_shared<BufferNode>();
+    BufferNodePtr node = newBufferNode();
     node->sendFd_ = sfd;
     node->offset_ = offset;
     node->fileBytesToSend_ = length;
-    if (loop_->isInLoopThread()) {
-        std::lock_guard<std::mutex> guard(sendNumMutex_);
-        if (sendNum_ == 0) {
-            writeBufferList_.push_back(node);
-            if (writeBufferList_.size() == 1) {
-                sendFileInLoop(writeBufferList_.front());
-                return;
-            }
-        } else {
-            ++sendNum_;
-            auto thisPtr = shared_from_this();
-            loop_->queueInLoop([thisPtr, node]() {
-                thisPtr->writeBufferList_.push_back(node);
-                {
-                    std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
-                    --thisPtr->sendNum_;
-                }
-
-                if (thisPtr->writeBufferList_.size() == 1) {
-                    thisPtr->sendFileInLoop(thisPtr->writeBufferList_.front());
-                }
-            });
-        }
-    } else {
-        auto thisPtr = shared_from_this();
-        std::lock_guard<std::mutex> guard(sendNumMutex_);
-        ++sendNum_;
-        loop_->queueInLoop([thisPtr, node]() {
-            LOG_TRACE << "Push sendfile to list";
-            thisPtr->writeBufferList_.push_back(node);
-
-            {
-                std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
-                --thisPtr->sendNum_;
-            }
-
-            if (thisPtr->writeBufferList_.size() == 1) {
-                thisPtr->sendFileInLoop(thisPtr->writeBufferList_.front());
-            }
-        });
+    if (canSendDirectly()) {
+        pushFileNodeInLoop(node);
+        return;
     }
+    queueSend([this, node = std::move(node)]() {
+        LOG_TRACE << "Push sendfile to list";
+        pushFileNodeInLoop(node);
+    });
 }
 
 void TcpConnectionImpl::sendStream(std::function<std::size_t(char*, std::size_t)> callback) {
-    BufferNodePtr node = std::make_shared<BufferNode>();
+    BufferNodePtr node = newBufferNode();
     node->offset_ = 0;           // not used, the offset should be handled by the callback
     node->fileBytesToSend_ = 1;  // force to > 0 until stream sent
     node->streamCallback_ = std::move(callback);
-    if (loop_->isInLoopThread()) {
-        std::lock_guard<std::mutex> guard(sendNumMutex_);
-        if (sendNum_ == 0) {
-            writeBufferList_.push_back(node);
-            if (writeBufferList_.size() == 1) {
-                sendFileInLoop(writeBufferList_.front());
-                return;
-            }
-        } else {
-            ++sendNum_;
-            auto thisPtr = shared_from_this();
-            loop_->queueInLoop([thisPtr, node]() {
-                thisPtr->writeBufferList_.push_back(node);
-                {
-                    std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
-                    --thisPtr->sendNum_;
-                }
-
-                if (thisPtr->writeBufferList_.size() == 1) {
-                    thisPtr->sendFileInLoop(thisPtr->writeBufferList_.front());
-                }
-            });
-        }
-    } else {
-        auto thisPtr = shared_from_this();
-        std::lock_guard<std::mutex> guard(sendNumMutex_);
-        ++sendNum_;
-        loop_->queueInLoop([thisPtr, node]() {
-            LOG_TRACE << "Push sendstream to list";
-            thisPtr->writeBufferList_.push_back(node);
-
-            {
-                std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
-                --thisPtr->sendNum_;
-            }
+    if (canSendDirectly()) {
+        pushFileNodeInLoop(node);
+        return;
+    }
+    queueSend([this, node = std::move(node)]() {
+        LOG_TRACE << "Push sendstream to list";
+        pushFileNodeInLoop(node);
+    });
+}
 
-            if (thisPtr->writeBufferList_.size() == 1) {
-                thisPtr->sendFileInLoop(thisPtr->writeBufferList_.front());
-            }
-        });
+void TcpConnectionImpl::pushFileNodeInLoop(const BufferNodePtr& node) {
+    writeBufferList_.push_back(node);
+    if (writeBufferList_.size() == 1) {
+        sendFileInLoop(writeBufferList_.front());
     }
 }
 
 void TcpConnectionImpl::sendFileInLoop(const BufferNodePtr& filePtr) {
+    writeFileInLoop(filePtr);
+    // In edge-triggered mode, a node which is sent completely without filling
+    // up the socket buffer would never be popped by the write callback.
+    if (ioChannelPtr_->isEdgeTriggered() && !writeCallbackLooping_ && filePtr->fileBytesToSend_ <= 0 &&
+        ioChannelPtr_->isWriting()) {
+        writeCallback();
+    }
+}
+
+void TcpConnectionImpl::writeFileInLoop(const BufferNodePtr& filePtr) {
     loop_->assertInLoopThread();
     assert(filePtr->isFile());
-    if (!filePtr->streamCallback_ && !tlsProviderPtr_) {
+    if (!filePtr->streamCallback_ && !encryptsInUserSpace()) {
         LOG_TRACE << "send file in loop using linux kernel sendfile()";
-        auto bytesSent = sendfile(socketPtr_->fd(), filePtr->sendFd_, &filePtr->offset_, filePtr->fileBytesToSend_);
+        size_t count = filePtr->fileBytesToSend_;
+        if (writeRateLimited() && count > writeQuota()) {
+            pauseWritingForRateLimit();
+            count = writeQuota();
+            if (count == 0) {
+                if (!ioChannelPtr_->isWriting()) {
+                    ioChannelPtr_->enableWriting();
+                }
+                return;
+            }
+        }
+        auto bytesSent = sendfile(socketPtr_->fd(), filePtr->sendFd_, &filePtr->offset_, count);
+        countWrite(bytesSent, count);
         if (bytesSent < 0) {
             if (errno != EAGAIN) {
                 LOG_SYSERR << "TcpConnectionImpl::sendFileInLoop";
@@ -694,6 +1680,10 @@ void TcpConnectionImpl::sendFileInLoop(const BufferNodePtr& filePtr) {
             }
         }
         LOG_TRACE << "sendfile() " << bytesSent << " bytes sent";
+        addBytes(bytesSent_, bytesSent);
+        if (writeRateLimited()) {
+            consumeWriteQuota(bytesSent);
+        }
         filePtr->fileBytesToSend_ -= bytesSent;
         LOG_TRACE << "filePtr->fileBytesToSend: " << filePtr->fileBytesToSend_;
         if (!ioChannelPtr_->isWriting()) {
@@ -773,20 +1763,25 @@ void TcpConnectionImpl::sendFileInLoop(const BufferNodePtr& filePtr) {
         return;
     }
     // Send file
+    if ((filePtr->fileBytesToSend_ >= static_cast<ssize_t>(kMinMappedFileSize) || filePtr->mappedData_) &&
+        writeMappedFileInLoop(filePtr)) {
+        return;
+    }
     LOG_TRACE << "send file in loop";
     if (!fileBufferPtr_) {
-        fileBufferPtr_ = std::make_unique<std::vector<char>>(kMaxSendFileBufferSize);
-    }
-    if (fileBufferPtr_->size() < kMaxSendFileBufferSize) {
-        fileBufferPtr_->resize(kMaxSendFileBufferSize);
+        fileBufferPtr_ = std::make_unique<std::vector<char>>();
     }
-    lseek(filePtr->sendFd_, filePtr->offset_, SEEK_SET);
     while (filePtr->fileBytesToSend_ > 0) {
-        auto n = read(
+        // The buffer is emptied after each chunk, so that it is not taken for
+        // the data left by a stream.
+        fileBufferPtr_->resize(kMaxSendFileBufferSize);
+        auto n = pread(
             filePtr->sendFd_, &(*fileBufferPtr_)[0],
-            std::min(fileBufferPtr_->size(), static_cast<decltype(fileBufferPtr_->size())>(filePtr->fileBytesToSend_)));
+            std::min(fileBufferPtr_->size(), static_cast<decltype(fileBufferPtr_->size())>(filePtr->fileBytesToSend_)),
+            filePtr->offset_);
+        ssize_t nSend = n > 0 ? writeInLoop(&(*fileBufferPtr_)[0], n) : 0;
+        fileBufferPtr_->clear();
         if (n > 0) {
-            auto nSend = writeInLoop(&(*fileBufferPtr_)[0], n);
             if (nSend >= 0) {
                 filePtr->fileBytesToSend_ -= nSend;
                 filePtr->offset_ += nSend;
@@ -834,21 +1829,223 @@ void TcpConnectionImpl::sendFileInLoop(const BufferNodePtr& filePtr) {
         ioChannelPtr_->enableWriting();
     }
 }
+
+bool TcpConnectionImpl::writeMappedFileInLoop(const BufferNodePtr& filePtr) {
+    LOG_TRACE << "send mapped file in loop";
+    if (filePtr->chunkSize_ == 0) {
+        filePtr->chunkSize_ = kMinFileChunkSize;
+    }
+    while (filePtr->fileBytesToSend_ > 0) {
+        if (!filePtr->mapSendWindow()) {
+            // Send the rest with read()
+            return false;
+        }
+        size_t nToWrite = static_cast<size_t>(filePtr->mappedOffset_ + filePtr->mappedLength_ - filePtr->offset_);
+        nToWrite = std::min(nToWrite, std::min(filePtr->chunkSize_, static_cast<size_t>(filePtr->fileBytesToSend_)));
+        auto nSend = writeInLoop(filePtr->mappedData_ + (filePtr->offset_ - filePtr->mappedOffset_), nToWrite);
+        if (nSend >= 0) {
+            filePtr->fileBytesToSend_ -= nSend;
+            filePtr->offset_ += nSend;
+            if (static_cast<size_t>(nSend) < nToWrite) {
+                filePtr->chunkSize_ = kMinFileChunkSize;
+                break;
+            }
+            filePtr->chunkSize_ = std::min(filePtr->chunkSize_ * 2, kMaxFileChunkSize);
+            continue;
+        }
+        if (errno != EWOULDBLOCK) {
+            if (errno == EPIPE || errno == ECONNRESET) {
+                LOG_TRACE << "EPIPE or ECONNRESET, errno=" << errno;
+                return true;
+            }
+            LOG_SYSERR << "send mapped file in loop: return on unexpected error(" << errno << ")";
+            return true;
+        }
+        // Keep the data encrypted but not sent small while the socket is full.
+        filePtr->chunkSize_ = kMinFileChunkSize;
+        break;
+    }
+    if (filePtr->fileBytesToSend_ <= 0) {
+        filePtr->unmapSendWindow();
+    }
+    if (!ioChannelPtr_->isWriting()) {
+        ioChannelPtr_->enableWriting();
+    }
+    return true;
+}
+
+bool TcpConnectionImpl::BufferNode::mapSendWindow() {
+    if (mappedData_ && offset_ >= mappedOffset_ && offset_ < mappedOffset_ + static_cast<off_t>(mappedLength_)) {
+        return true;
+    }
+    unmapSendWindow();
+    if (mapFailed_) {
+        return false;
+    }
+    static const off_t pageSize = sysconf(_SC_PAGESIZE);
+    off_t start = offset_ - offset_ % pageSize;
+    off_t end = std::min(offset_ + static_cast<off_t>(fileBytesToSend_), start + static_cast<off_t>(kMappedWindowSize));
+    // Accessing the pages beyond the end of a truncated file raises SIGBUS,
+    // the rest of such a file is read instead.
+    struct stat st;
+    if (fstat(sendFd_, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < end) {
+        mapFailed_ = true;
+        return false;
+    }
+    void* data = mmap(nullptr, end - start, PROT_READ, MAP_SHARED, sendFd_, start);
+    if (data == MAP_FAILED) {
+        LOG_TRACE << "mmap() failed, errno=" << errno;
+        mapFailed_ = true;
+        return false;
+    }
+    // The pages are read ahead aggressively and may be reclaimed soon after
+    // they are sent.
+    madvise(data, end - start, MADV_SEQUENTIAL);
+    mappedData_ = static_cast<char*>(data);
+    mappedOffset_ = start;
+    mappedLength_ = end - start;
+    return true;
+}
+
+void TcpConnectionImpl::BufferNode::unmapSendWindow() {
+    if (mappedData_) {
+        munmap(mappedData_, mappedLength_);
+        mappedData_ = nullptr;
+        mappedLength_ = 0;
+    }
+}
 ssize_t TcpConnectionImpl::writeRaw(const void* buffer, size_t length) {
-    // TODO: Abstract this away to support io_uring (and IOCP?)
+    if (writeRateLimited()) {
+        size_t quota = writeQuota();
+        if (length > quota) {
+            // Taken as a partial write by the callers, which queue the rest.
+            pauseWritingForRateLimit();
+            length = quota;
+            if (length == 0) {
+                return 0;
+            }
+        }
+    }
     int nWritten = write(socketPtr_->fd(), buffer, length);
-    if (nWritten > 0)
-        bytesSent_ += nWritten;
+    countWrite(nWritten, length);
+    if (nWritten > 0) {
+        addBytes(bytesSent_, nWritten);
+        if (writeRateLimited()) {
+            consumeWriteQuota(nWritten);
+        }
+    }
+    return nWritten;
+}
+
+ssize_t TcpConnectionImpl::writevRaw(const struct iovec* iov, int iovcnt, int flags) {
+    struct iovec limitedIov[IOV_MAX];
+    if (writeRateLimited()) {
+        // Cut the vector at the quota.
+        size_t quota = writeQuota();
+        int i = 0;
+        for (; i < iovcnt && quota >= iov[i].iov_len; ++i) {
+            quota -= iov[i].iov_len;
+        }
+        if (i < iovcnt) {
+            pauseWritingForRateLimit();
+            if (i == 0 && quota == 0) {
+                return 0;
+            }
+            memcpy(limitedIov, iov, i * sizeof(struct iovec));
+            limitedIov[i].iov_base = iov[i].iov_base;
+            limitedIov[i].iov_len = quota;
+            iov = limitedIov;
+            iovcnt = i + 1;
+        }
+    }
+    ssize_t nWritten;
+    if (flags == 0) {
+        nWritten = ::writev(socketPtr_->fd(), iov, iovcnt);
+    } else {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = const_cast<struct iovec*>(iov);
+        msg.msg_iovlen = iovcnt;
+        nWritten = ::sendmsg(socketPtr_->fd(), &msg, flags);
+    }
+    size_t length = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        length += iov[i].iov_len;
+    }
+    countWrite(nWritten, length);
+    if (nWritten > 0) {
+        addBytes(bytesSent_, nWritten);
+        if (writeRateLimited()) {
+            consumeWriteQuota(nWritten);
+        }
+    }
     return nWritten;
 }
 
 ssize_t TcpConnectionImpl::writeInLoop(const void* buffer, size_t length) {
-    if (tlsProviderPtr_)
+    if (encryptsInUserSpace())
         return tlsProviderPtr_->sendData((const char*)buffer, length);
     else
         return writeRaw(buffer, length);
 }
 
+void TcpConnectionImpl::countWrite(ssize_t n, size_t length) {
+    if (n < 0) {
+        if (errno == EAGAIN) {
+            wouldBlockWrites_.store(wouldBlockWrites_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+        return;
+    }
+    if (n > 0) {
+        lastWriteTimeUs_.store(steadyMicroseconds(), std::memory_order_relaxed);
+    }
+    if (static_cast<size_t>(n) < length) {
+        partialWrites_.store(partialWrites_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+}
+
+void TcpConnectionImpl::countRead() {
+    lastReadTimeUs_.store(steadyMicroseconds(), std::memory_order_relaxed);
+}
+
+TcpConnectionStats TcpConnectionImpl::stats() const {
+    TcpConnectionStats stats;
+    stats.bytesSent = bytesSent_.load(std::memory_order_relaxed);
+    stats.bytesReceived = bytesReceived_.load(std::memory_order_relaxed);
+    stats.queuedBytes = queuedBytes();
+    stats.peakQueuedBytes = peakQueuedBytes_.load(std::memory_order_relaxed);
+    stats.partialWrites = partialWrites_.load(std::memory_order_relaxed);
+    stats.wouldBlockWrites = wouldBlockWrites_.load(std::memory_order_relaxed);
+    int64_t now = steadyMicroseconds();
+    stats.sinceLastRead = std::chrono::microseconds(now - lastReadTimeUs_.load(std::memory_order_relaxed));
+    stats.sinceLastWrite = std::chrono::microseconds(now - lastWriteTimeUs_.load(std::memory_order_relaxed));
+    return stats;
+}
+
+bool TcpConnectionImpl::tcpInfo(TcpInfo* info) const {
+    struct tcp_info tcpi;
+    if (!socketPtr_->getTcpInfo(&tcpi)) {
+        return false;
+    }
+    info->rtt = std::chrono::microseconds(tcpi.tcpi_rtt);
+    info->rttVar = std::chrono::microseconds(tcpi.tcpi_rttvar);
+    info->sndCwnd = tcpi.tcpi_snd_cwnd;
+    info->sndSsthresh = tcpi.tcpi_snd_ssthresh;
+    info->sndMss = tcpi.tcpi_snd_mss;
+    info->unacked = tcpi.tcpi_unacked;
+    info->lost = tcpi.tcpi_lost;
+    info->retransmits = tcpi.tcpi_retransmits;
+    info->totalRetrans = tcpi.tcpi_total_retrans;
+    info->sendQueueBytes = socketPtr_->getSendQueueBytes();
+    return true;
+}
+
+bool TcpConnectionImpl::encryptsInUserSpace() const {
+    // With kernel TLS, the data written to the socket is encrypted by the
+    // kernel, so it is sent like on a plain connection.
+    return tlsProviderPtr_ && !tlsProviderPtr_->kernelTLSEnabled();
+}
+
 void TcpConnectionImpl::startEncryption(TLSPolicyPtr policy, bool isServer,
                                         std::function<void(const TcpConnectionPtr&)> upgradeCallback) {
     if (tlsProviderPtr_ || upgradeCallback_) {
@@ -858,6 +2055,7 @@ void TcpConnectionImpl::startEncryption(TLSPolicyPtr policy, bool isServer,
     auto sslContextPtr = newSSLContext(*policy, isServer);
     tlsProviderPtr_ = newTLSProvider(this, policy, sslContextPtr);
     tlsProviderPtr_->setWriteCallback(onSslWrite);
+    tlsProviderPtr_->setSocketFd(socketPtr_->fd());
     tlsProviderPtr_->setErrorCallback(onSslError);
     tlsProviderPtr_->setHandshakeCallback(onHandshakeFinished);
     tlsProviderPtr_->setMessageCallback(onSslMessage);
@@ -881,8 +2079,7 @@ void TcpConnectionImpl::onHandshakeFinished(TcpConnection* self) {
         self->connectionCallback_(connPtr);
 }
 void TcpConnectionImpl::onSslMessage(TcpConnection* self, MsgBuffer* buffer) {
-    if (self->recvMsgCallback_)
-        self->recvMsgCallback_(((TcpConnectionImpl*)self)->shared_from_this(), buffer);
+    ((TcpConnectionImpl*)self)->deliverMessage(buffer);
 }
 ssize_t TcpConnectionImpl::onSslWrite(TcpConnection* self, const void* data, size_t len) {
     auto connPtr = (TcpConnectionImpl*)self;
@@ -1,16 +1,23 @@
 #ifndef net_TcpConnectionImpl_hpp
 #define net_TcpConnectionImpl_hpp
 
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <array>
-#include <list>
-#include <mutex>
+#include <atomic>
 #include <thread>
 
+#include "cooper/net/PipePool.hpp"
 #include "cooper/net/TLSProvider.hpp"
 #include "cooper/net/TcpConnection.hpp"
+#include "cooper/util/BufferPool.hpp"
+#include "cooper/util/LockFreeQueue.hpp"
+#include "cooper/util/RingBuffer.hpp"
+#include "cooper/util/RingQueue.hpp"
+#include "cooper/util/TaskQueue.hpp"
 #include "cooper/util/TimingWheel.hpp"
+#include "cooper/util/TokenBucket.hpp"
 
 namespace cooper {
 class Channel;
@@ -56,6 +63,9 @@ public:
     virtual void send(MsgBuffer&& buffer) override;
     virtual void send(const std::shared_ptr<std::string>& msgPtr) override;
     virtual void send(const std::shared_ptr<MsgBuffer>& msgPtr) override;
+    virtual void send(const std::shared_ptr<std::string>& msgPtr, const SendCompleteCallback& cb) override;
+    virtual void send(const std::shared_ptr<MsgBuffer>& msgPtr, const SendCompleteCallback& cb) override;
+    virtual void send(const std::vector<BufferSlice>& slices) override;
     virtual void sendJson(const json& json) override;
     virtual void sendFile(const char* fileName, size_t offset = 0, size_t length = 0) override;
     virtual void sendFile(const wchar_t* fileName, size_t offset = 0, size_t length = 0) override;
@@ -96,6 +106,18 @@ public:
     virtual bool isKeepAlive() override {
         return idleTimeout_ == 0;
     }
+    virtual void stopRead() override;
+    virtual void startRead() override;
+    virtual void setFlowControl(size_t highMark, size_t lowMark) override;
+    virtual size_t queuedBytes() const override {
+        return queuedBytes_.load(std::memory_order_relaxed);
+    }
+    virtual void setReadBufferIdleTime(double seconds) override;
+    virtual void setReadBatchBytes(size_t bytes) override;
+    virtual void setRateLimit(size_t readBytesPerSecond, size_t writeBytesPerSecond, size_t burstBytes = 0) override;
+    virtual void setAutoCork(bool on) override;
+    virtual void flush() override;
+    virtual void forwardTo(const TcpConnectionPtr& target) override;
     virtual void setTcpNoDelay(bool on) override;
     virtual void shutdown() override;
     virtual void forceClose() override;
@@ -104,11 +126,13 @@ public:
     }
 
     virtual size_t bytesSent() const override {
-        return bytesSent_;
+        return bytesSent_.load(std::memory_order_relaxed);
     }
     virtual size_t bytesReceived() const override {
-        return bytesReceived_;
+        return bytesReceived_.load(std::memory_order_relaxed);
     }
+    virtual TcpConnectionStats stats() const override;
+    virtual bool tcpInfo(TcpInfo* info) const override;
 
     virtual bool isSSLConnection() const override {
         return tlsProviderPtr_ != nullptr;
@@ -154,6 +178,14 @@ public:
         timingWheel->insertEntry(timeout, entry);
     }
 
+    /**
+     * @brief Register the socket of the connection in edge-triggered mode, in
+     * which the socket is read until EAGAIN on every read event, and written
+     * until EAGAIN or nothing is left on every write event.
+     * @note This method must be called before connectEstablished().
+     */
+    void enableEdgeTriggered();
+
 private:
     /// Internal use only.
     std::weak_ptr<KickoffEntry> kickoffEntry_;
@@ -169,13 +201,28 @@ protected:
         int sendFd_{-1};
         off_t offset_{0};
         ssize_t fileBytesToSend_{0};
+        // The window of the file mapped to be sent without sendfile(), and the
+        // size of the chunks written from it
+        char* mappedData_{nullptr};
+        off_t mappedOffset_{0};
+        size_t mappedLength_{0};
+        size_t chunkSize_{0};
+        bool mapFailed_{false};
+        bool mapSendWindow();
+        void unmapSendWindow();
         // sendStream() specific
         std::function<std::size_t(char*, std::size_t)> streamCallback_;
 #ifndef NDEBUG  // defined by CMake for release build
         std::size_t nDataWritten_{0};
 #endif
-        // generic
-        std::shared_ptr<MsgBuffer> msgBuffer_;
+        // send() of a shared buffer specific, the buffer of the caller is
+        // referenced instead of copied
+        std::shared_ptr<const void> sharedData_;
+        const char* data_{nullptr};
+        size_t dataLength_{0};
+        SendCompleteCallback sendCompleteCallback_;
+        // generic, taken from the buffer pool of the thread
+        std::unique_ptr<MsgBuffer> msgBuffer_;
         bool isFile() const {
             if (streamCallback_)
                 return true;
@@ -183,11 +230,34 @@ protected:
                 return true;
             return false;
         }
+        bool isShared() const {
+            return sharedData_ != nullptr;
+        }
+        const char* peek() const {
+            return sharedData_ ? data_ : msgBuffer_->peek();
+        }
+        size_t readableBytes() const {
+            return sharedData_ ? dataLength_ : msgBuffer_->readableBytes();
+        }
+        void retrieve(size_t len) {
+            if (sharedData_) {
+                assert(len <= dataLength_);
+                data_ += len;
+                dataLength_ -= len;
+            } else {
+                msgBuffer_->retrieve(len);
+            }
+        }
         ~BufferNode() {
+            unmapSendWindow();
             if (sendFd_ >= 0)
                 close(sendFd_);
             if (streamCallback_)
                 streamCallback_(nullptr, 0);  // cleanup callback internals
+            if (sendCompleteCallback_)
+                sendCompleteCallback_(dataLength_ == 0);
+            if (msgBuffer_)
+                BufferPool::releaseBuffer(std::move(msgBuffer_));
         }
         bool closeConnection_ = false;
     };
@@ -197,9 +267,13 @@ protected:
     std::unique_ptr<Channel> ioChannelPtr_;
     std::shared_ptr<Socket> socketPtr_;
     MsgBuffer readBuffer_;
-    std::list<BufferNodePtr> writeBufferList_;
+    // The buffer which the data is read into instead if the ring message
+    // callback is set, it holds no memory until then.
+    RingBuffer ringReadBuffer_{0};
+    RingQueue<BufferNodePtr> writeBufferList_;
     void readCallback();
     void writeCallback();
+    void writeBufferedData();
     InetAddress localAddr_, peerAddr_;
     ConnStatus status_{ConnStatus::Connecting};
     void handleClose();
@@ -207,23 +281,181 @@ protected:
     // virtual void sendInLoop(const std::string &msg);
 
     void sendFileInLoop(const BufferNodePtr& file);
+    void writeFileInLoop(const BufferNodePtr& file);
+    bool writeMappedFileInLoop(const BufferNodePtr& file);
     void sendInLoop(const void* buffer, size_t length);
+    void sendInLoop(const BufferSlice* slices, size_t count);
+    void sendSharedInLoop(const BufferNodePtr& node);
+    void corkInLoop(const void* buffer, size_t length);
+    void scheduleFlush();
+    void flushInLoop();
+    void sendShared(BufferNodePtr&& node);
+    SendCompleteCallback callInLoop(const SendCompleteCallback& cb) const;
+    bool canSendDirectly() const;
+    bool enqueueSend(Task&& task);
+    void queueSend(Task&& task);
+    void drainOutboundQueue();
+    void pushFileNodeInLoop(const BufferNodePtr& node);
+    void updateReading();
+    void checkFlowControl();
+    void deliverMessage(MsgBuffer* buffer);
+    void deliverRingMessage();
+    bool readsIntoRing() const {
+        return recvRingMsgCallback_ && !tlsProviderPtr_;
+    }
+    template <typename Buffer>
+    ssize_t readInto(Buffer& buffer, size_t quota, int* retErrno, bool* more);
+    template <typename Buffer>
+    ssize_t readBatch(Buffer& buffer, int* retErrno, bool* more);
+    ssize_t readWithQuota(MsgBuffer& buffer, size_t quota, bool* more);
+    ssize_t readWithQuota(RingBuffer& buffer, size_t quota, bool* more);
+    size_t readSizeHint() const;
+    template <typename Buffer>
+    void adjustReadBuffer(Buffer& buffer, size_t n);
+    void scheduleReadBufferRelease(double delay);
+    void releaseIdleReadBuffer();
+    bool canSpliceTo(const TcpConnectionImpl& target) const;
+    bool spliceToTarget(const std::shared_ptr<TcpConnectionImpl>& target);
+    bool flushForwardPipe(const std::shared_ptr<TcpConnectionImpl>& target);
+    void pauseForwarding();
+    void throttleForwarding(const std::shared_ptr<TcpConnectionImpl>& target);
+    void resumeForwarding();
+    void notifyForwardSource();
+    void notifyForwardSourceOfClose();
+    void stopForwarding();
+    void releaseForwardPipe();
+    void addQueuedBytes(size_t n) {
+        size_t queued = queuedBytes_.load(std::memory_order_relaxed) + n;
+        queuedBytes_.store(queued, std::memory_order_relaxed);
+        if (queued > peakQueuedBytes_.load(std::memory_order_relaxed)) {
+            peakQueuedBytes_.store(queued, std::memory_order_relaxed);
+        }
+    }
+    static void addBytes(std::atomic<size_t>& counter, size_t n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    void subQueuedBytes(size_t n) {
+        queuedBytes_.store(queuedBytes_.load(std::memory_order_relaxed) - n, std::memory_order_relaxed);
+    }
+    static BufferNodePtr newBufferNode();
+    static BufferNodePtr newMemoryNode();
+    static BufferNodePtr newSharedNode(std::shared_ptr<const void> holder, const char* data, size_t length,
+                                       const SendCompleteCallback& cb);
+    void appendToWriteBuffer(const void* buffer, size_t length);
+    void writeMemoryNodes();
+    int gatherMemoryNodes(struct iovec* iov, int maxCount, int* flags, BufferNode** last);
+    void retrieveMemoryNodes(size_t n);
+    void recvCompletion(const char* data, ssize_t n);
+    int prepareSend(struct iovec* vec, int maxCount, int* flags, std::shared_ptr<void>* keepAlive);
+    void sendCompletion(ssize_t n);
+    bool sendsByCompletion() const {
+        return completionIo_ && !tlsProviderPtr_ && !writeRateLimited();
+    }
+    void deliverReceived(size_t n, bool ring, bool limited);
     ssize_t writeRaw(const void* buffer, size_t length);
+    ssize_t writevRaw(const struct iovec* iov, int iovcnt, int flags = 0);
     ssize_t writeInLoop(const void* buffer, size_t length);
+    void countWrite(ssize_t n, size_t length);
+    void countRead();
+    bool encryptsInUserSpace() const;
+    bool readRateLimited() const {
+        return readBucket_ || serverReadBucket_;
+    }
+    bool writeRateLimited() const {
+        return writeBucket_ || serverWriteBucket_;
+    }
+    size_t readQuota() const;
+    size_t writeQuota() const;
+    void consumeReadQuota(size_t n);
+    void consumeWriteQuota(size_t n);
+    void pauseReadingForRateLimit();
+    void pauseWritingForRateLimit();
+    void resumeReadingAfterRateLimit();
+    void resumeWritingAfterRateLimit();
     size_t highWaterMarkLen_;
     std::string name_;
 
-    uint64_t sendNum_{0};
-    std::mutex sendNumMutex_;
+    // The sends that have to wait for the ones from other threads, in order.
+    MpscQueue<Task> outboundQueue_;
+    std::atomic<size_t> pendingSendNum_{0};
+    std::atomic<bool> drainScheduled_{false};
 
-    size_t bytesSent_{0};
-    size_t bytesReceived_{0};
+    // Only written in the thread of the event loop.
+    std::atomic<size_t> queuedBytes_{0};
+    size_t flowHighMark_{0};
+    size_t flowLowMark_{0};
+    bool readStopped_{false};
+    bool readPausedByFlowControl_{false};
+
+    // The average size of the recent reads, by which the read buffer is
+    // sized.
+    size_t readSizeEstimate_{kBufferDefaultLength};
+    double readBufferIdleTime_{0};
+    TimerId readBufferTimerId_{InvalidTimerId};
+    static constexpr size_t kMaxReadSizeHint = 64 * 1024;
+    size_t readBatchBytes_{0};
+    // The sends in the loop thread up to kMaxCorkedSendSize bytes are held
+    // until the end of the loop iteration if autoCork_ is true.
+    static constexpr size_t kMaxCorkedSendSize = 16 * 1024;
+    bool autoCork_{false};
+    bool flushScheduled_{false};
+
+    // setRateLimit() specific, the buckets of the server are shared by all its
+    // connections. A paused direction is resumed by a timer when the buckets
+    // are refilled.
+    std::unique_ptr<TokenBucket> readBucket_;
+    std::unique_ptr<TokenBucket> writeBucket_;
+    std::shared_ptr<TokenBucket> serverReadBucket_;
+    std::shared_ptr<TokenBucket> serverWriteBucket_;
+    bool readPausedByRateLimit_{false};
+    bool writePausedByRateLimit_{false};
+    TimerId readRateTimerId_{InvalidTimerId};
+    TimerId writeRateTimerId_{InvalidTimerId};
+
+    // forwardTo() specific
+    std::weak_ptr<TcpConnectionImpl> forwardTarget_;
+    std::weak_ptr<TcpConnectionImpl> forwardSource_;
+    PipePool::Pipe forwardPipe_;
+    size_t forwardPipeBytes_{0};
+    // Read by the target in its own thread to decide whether to resume the
+    // source.
+    std::atomic<bool> forwardPaused_{false};
+    static constexpr size_t kSpliceChunkSize = 64 * 1024;
+    static constexpr size_t kForwardHighMark = 1024 * 1024;
+    static constexpr size_t kForwardLowMark = 256 * 1024;
+    // The files sent without sendfile() are mapped in windows of this size if
+    // they are not smaller than kMinMappedFileSize, and written in chunks that
+    // grow from kMinFileChunkSize to kMaxFileChunkSize while the socket takes
+    // them.
+    static constexpr size_t kMappedWindowSize = 4 * 1024 * 1024;
+    static constexpr size_t kMinMappedFileSize = 64 * 1024;
+    static constexpr size_t kMinFileChunkSize = 16 * 1024;
+    static constexpr size_t kMaxFileChunkSize = 64 * 1024;
+
+    // Only written in the thread of the event loop. The times are in
+    // microseconds of the steady clock.
+    std::atomic<size_t> bytesSent_{0};
+    std::atomic<size_t> bytesReceived_{0};
+    std::atomic<size_t> peakQueuedBytes_{0};
+    std::atomic<uint64_t> partialWrites_{0};
+    std::atomic<uint64_t> wouldBlockWrites_{0};
+    std::atomic<int64_t> lastReadTimeUs_{0};
+    std::atomic<int64_t> lastWriteTimeUs_{0};
 
     std::unique_ptr<std::vector<char>> fileBufferPtr_;
     std::shared_ptr<TLSProvider> tlsProviderPtr_;
     std::function<void(const TcpConnectionPtr&)> upgradeCallback_;
 
     bool closeOnEmpty_{false};
+    bool writeCallbackLooping_{false};
+
+    // Whether the poller reads and writes the socket itself, see
+    // Channel::setRecvCallback(). The memory nodes up to sendingTail_ are in
+    // the send in progress, so they are neither appended to nor retrieved
+    // until it completes.
+    bool completionIo_{false};
+    BufferNode* sendingTail_{nullptr};
+    size_t sendingBytes_{0};
 
     static void onSslError(TcpConnection* self, SSLError err);
     static void onHandshakeFinished(TcpConnection* self);
@@ -1,10 +1,13 @@
 #include "TcpServer.hpp"
 
+#include <algorithm>
 #include <functional>
+#include <unordered_map>
 #include <vector>
 
 #include "cooper/net/Acceptor.hpp"
 #include "cooper/net/TcpConnectionImpl.hpp"
+#include "cooper/util/CpuAffinity.hpp"
 #include "cooper/util/Logger.hpp"
 using namespace cooper;
 using namespace std::placeholders;
@@ -40,11 +43,8 @@ void TcpServer::setAfterAcceptSockOptCallback(SockOptCallback cb) {
 void TcpServer::newConnection(int sockfd, const InetAddress& peer) {
     LOG_TRACE << "new connection:fd=" << sockfd << " address=" << peer.toIpPort();
     loop_->assertInLoopThread();
-    EventLoop* ioLoop = ioLoops_[nextLoopIdx_];
-    if (++nextLoopIdx_ >= numIoLoops_) {
-        nextLoopIdx_ = 0;
-    }
-    TcpConnectionPtr newPtr;
+    EventLoop* ioLoop = getNextIoLoop(sockfd);
+    TcpConnectionImplPtr newPtr;
     if (policyPtr_) {
         assert(sslContextPtr_);
         newPtr = std::make_shared<TcpConnectionImpl>(ioLoop, sockfd, InetAddress(Socket::getLocalAddr(sockfd)), peer,
@@ -53,6 +53,26 @@ void TcpServer::newConnection(int sockfd, const InetAddress& peer) {
         newPtr = std::make_shared<TcpConnectionImpl>(ioLoop, sockfd, InetAddress(Socket::getLocalAddr(sockfd)), peer);
     }
 
+    if (edgeTriggered_) {
+        newPtr->enableEdgeTriggered();
+    }
+    if (busyPollUs_ > 0) {
+        newPtr->socketPtr_->setBusyPoll(busyPollUs_);
+    }
+    if (readBufferIdleTime_ > 0) {
+        newPtr->setReadBufferIdleTime(readBufferIdleTime_);
+    }
+    if (readBatchBytes_ > 0) {
+        newPtr->setReadBatchBytes(readBatchBytes_);
+    }
+    if (autoCork_) {
+        newPtr->setAutoCork(true);
+    }
+    newPtr->serverReadBucket_ = readBucket_;
+    newPtr->serverWriteBucket_ = writeBucket_;
+    if (connReadRate_ > 0 || connWriteRate_ > 0) {
+        newPtr->setRateLimit(connReadRate_, connWriteRate_, connRateBurst_);
+    }
     if (idleTimeout_ > 0) {
         assert(timingWheelMap_[ioLoop]);
         newPtr->enableKickingOff(idleTimeout_, timingWheelMap_[ioLoop]);
@@ -75,6 +95,31 @@ void TcpServer::newConnection(int sockfd, const InetAddress& peer) {
     newPtr->connectEstablished();
 }
 
+EventLoop* TcpServer::getNextIoLoop(int sockfd) {
+#ifdef SO_INCOMING_CPU
+    if (!numaLoopsMap_.empty()) {
+        int cpu = -1;
+        socklen_t len = sizeof(cpu);
+        if (::getsockopt(sockfd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0) {
+            auto iter = numaLoopsMap_.find(utils::numaNodeOfCpu(cpu));
+            if (iter != numaLoopsMap_.end()) {
+                auto& numaLoops = iter->second;
+                EventLoop* ioLoop = numaLoops.loops[numaLoops.nextLoopIdx];
+                if (++numaLoops.nextLoopIdx >= numaLoops.loops.size()) {
+                    numaLoops.nextLoopIdx = 0;
+                }
+                return ioLoop;
+            }
+        }
+    }
+#endif
+    EventLoop* ioLoop = ioLoops_[nextLoopIdx_];
+    if (++nextLoopIdx_ >= numIoLoops_) {
+        nextLoopIdx_ = 0;
+    }
+    return ioLoop;
+}
+
 void TcpServer::start() {
     loop_->runInLoop([this]() {
         assert(!started_);
@@ -85,6 +130,25 @@ void TcpServer::start() {
                                                                       idleTimeout_ < 500 ? idleTimeout_ + 1 : 100);
             }
         }
+        if (numaAwareAccept_) {
+            for (EventLoop* loop : ioLoops_) {
+                if (loop->numaNode() >= 0) {
+                    numaLoopsMap_[loop->numaNode()].loops.push_back(loop);
+                }
+            }
+            if (numaLoopsMap_.empty()) {
+                LOG_WARN << "No I/O event loop is pinned to a NUMA node, connections are dispatched round-robin";
+            }
+        }
+        if (watchdogPtr_) {
+            watchdogPtr_->watch(loop_);
+            for (EventLoop* loop : ioLoops_) {
+                if (loop != loop_) {
+                    watchdogPtr_->watch(loop);
+                }
+            }
+            watchdogPtr_->start();
+        }
         LOG_TRACE << "map size=" << timingWheelMap_.size();
         acceptorPtr_->listen();
     });
@@ -119,6 +183,9 @@ void TcpServer::stop() {
         });
         f.get();
     }
+    if (watchdogPtr_) {
+        watchdogPtr_->stop();
+    }
     loopPoolPtr_.reset();
     for (auto& iter : timingWheelMap_) {
         std::promise<void> pro;
@@ -130,6 +197,101 @@ void TcpServer::stop() {
         f.get();
     }
 }
+void TcpServer::broadcast(const std::shared_ptr<const std::string>& msgPtr,
+                          const std::vector<TcpConnectionPtr>& conns) {
+    // The connections whose outbound queues must be drained, by event loop.
+    std::unordered_map<EventLoop*, std::vector<std::shared_ptr<TcpConnectionImpl>>> drains;
+    for (auto& conn : conns) {
+        // Every connection has its own node to record how much data is sent,
+        // the data itself is shared. The node takes its place among the sends
+        // to the connection now, in the calling thread, like a send() does.
+        auto connPtr = std::static_pointer_cast<TcpConnectionImpl>(conn);
+        auto node = TcpConnectionImpl::newSharedNode(msgPtr, msgPtr->data(), msgPtr->length(), nullptr);
+        if (connPtr->canSendDirectly()) {
+            connPtr->sendSharedInLoop(node);
+            continue;
+        }
+        // A drain scheduled already keeps the connection alive until it runs.
+        TcpConnectionImpl* rawPtr = connPtr.get();
+        bool needsDrain = rawPtr->enqueueSend([rawPtr, node = std::move(node)]() {
+            rawPtr->sendSharedInLoop(node);
+        });
+        if (needsDrain) {
+            drains[rawPtr->getLoop()].push_back(std::move(connPtr));
+        }
+    }
+    // One task per event loop instead of one per connection.
+    for (auto& drain : drains) {
+        drain.first->queueInLoop([connPtrs = std::move(drain.second)]() {
+            for (auto& connPtr : connPtrs) {
+                connPtr->drainOutboundQueue();
+            }
+        });
+    }
+}
+void TcpServer::broadcast(const std::shared_ptr<const std::string>& msgPtr) {
+    loop_->runInLoop([this, msgPtr]() {
+        std::vector<TcpConnectionPtr> connPtrs(connSet_.begin(), connSet_.end());
+        broadcast(msgPtr, connPtrs);
+    });
+}
+static uint64_t rankValue(const TcpConnectionReport& report, TcpConnectionRank rank) {
+    switch (rank) {
+        case TcpConnectionRank::kQueuedBytes:
+            return report.stats.queuedBytes;
+        case TcpConnectionRank::kPeakQueuedBytes:
+            return report.stats.peakQueuedBytes;
+        case TcpConnectionRank::kWouldBlockWrites:
+            return report.stats.wouldBlockWrites;
+        case TcpConnectionRank::kSinceLastWrite:
+            return report.stats.sinceLastWrite.count();
+        case TcpConnectionRank::kSendQueueBytes:
+            return report.tcpInfo.sendQueueBytes;
+        case TcpConnectionRank::kRtt:
+            return report.tcpInfo.rtt.count();
+        case TcpConnectionRank::kRetransmits:
+            return report.tcpInfo.totalRetrans;
+    }
+    return 0;
+}
+void TcpServer::reportConnections(size_t n, TcpConnectionRank rank,
+                                  std::function<void(std::vector<TcpConnectionReport>&&)> callback) {
+    loop_->runInLoop([this, n, rank, callback = std::move(callback)]() {
+        std::vector<TcpConnectionReport> reports(connSet_.size());
+        size_t i = 0;
+        for (auto& conn : connSet_) {
+            auto& report = reports[i++];
+            report.connection = conn;
+            report.stats = conn->stats();
+            report.hasTcpInfo = conn->tcpInfo(&report.tcpInfo);
+        }
+        size_t top = std::min(n, reports.size());
+        std::partial_sort(reports.begin(), reports.begin() + top, reports.end(),
+                          [rank](const TcpConnectionReport& a, const TcpConnectionReport& b) {
+                              return rankValue(a, rank) > rankValue(b, rank);
+                          });
+        reports.resize(top);
+        callback(std::move(reports));
+    });
+}
+std::string TcpServer::formatReports(const std::vector<TcpConnectionReport>& reports) {
+    std::string text =
+        "peer queued peak partial eagain read_idle_ms write_idle_ms rtt_us cwnd retrans sendq sent received\n";
+    char line[256];
+    for (auto& report : reports) {
+        auto& stats = report.stats;
+        auto& info = report.tcpInfo;
+        snprintf(line, sizeof(line), "%s %zu %zu %llu %llu %lld %lld %lld %u %u %zu %zu %zu\n",
+                 report.connection->peerAddr().toIpPort().c_str(), stats.queuedBytes, stats.peakQueuedBytes,
+                 static_cast<unsigned long long>(stats.partialWrites),
+                 static_cast<unsigned long long>(stats.wouldBlockWrites),
+                 static_cast<long long>(stats.sinceLastRead.count() / 1000),
+                 static_cast<long long>(stats.sinceLastWrite.count() / 1000), static_cast<long long>(info.rtt.count()),
+                 info.sndCwnd, info.totalRetrans, info.sendQueueBytes, stats.bytesSent, stats.bytesReceived);
+        text += line;
+    }
+    return text;
+}
 void TcpServer::handleCloseInLoop(const TcpConnectionPtr& connectionPtr) {
     size_t n = connSet_.erase(connectionPtr);
     (void)n;
@@ -9,13 +9,44 @@
 #include "cooper/net/CallBacks.hpp"
 #include "cooper/net/EventLoopThreadPool.hpp"
 #include "cooper/net/InetAddress.hpp"
+#include "cooper/net/LoopWatchdog.hpp"
 #include "cooper/net/TcpConnection.hpp"
 #include "cooper/util/Logger.hpp"
 #include "cooper/util/NonCopyable.hpp"
 #include "cooper/util/TimingWheel.hpp"
+#include "cooper/util/TokenBucket.hpp"
 
 namespace cooper {
 class Acceptor;
+
+/**
+ * @brief The statistics of a connection to a server, see
+ * TcpServer::reportConnections().
+ *
+ */
+struct TcpConnectionReport {
+    TcpConnectionPtr connection;
+    TcpConnectionStats stats;
+    // Valid if hasTcpInfo is true.
+    TcpInfo tcpInfo;
+    bool hasTcpInfo{false};
+};
+
+/**
+ * @brief The value by which the connections are ranked in a report, the
+ * largest first.
+ *
+ */
+enum class TcpConnectionRank {
+    kQueuedBytes,
+    kPeakQueuedBytes,
+    kWouldBlockWrites,
+    kSinceLastWrite,
+    kSendQueueBytes,
+    kRtt,
+    kRetransmits
+};
+
 /**
  * @brief This class represents a TCP server.
  *
@@ -54,10 +85,15 @@ public:
      * An EventLoopThreadPool is created and managed by TcpServer.
      *
      * @param num
+     * @param pollerType The I/O multiplexing mechanism of the event loops.
+     * @param affinity The policy to place the threads of the event loops on
+     * CPUs.
      */
-    void setIoLoopNum(size_t num) {
+    void setIoLoopNum(size_t num,
+                      PollerType pollerType = PollerType::kEpoll,
+                      const CpuAffinityPolicy& affinity = CpuAffinityPolicy()) {
         assert(!started_);
-        loopPoolPtr_ = std::make_shared<EventLoopThreadPool>(num);
+        loopPoolPtr_ = std::make_shared<EventLoopThreadPool>(num, "EventLoopThreadPool", pollerType, affinity);
         loopPoolPtr_->start();
         ioLoops_ = loopPoolPtr_->getLoops();
         numIoLoops_ = ioLoops_.size();
@@ -188,6 +224,53 @@ public:
         return ioLoops_;
     }
 
+    /**
+     * @brief Send the same data to a set of connections. The data is shared
+     * by the write queues of all the connections instead of being copied into
+     * each of them.
+     *
+     * @param msgPtr The data, which must not be modified after the call.
+     * @param conns The connections, the order of the data sent to each of
+     * them is kept as if TcpConnection::send() was called.
+     * @note The data is queued for every connection in the calling thread,
+     * and the queues are drained by a single task per event loop.
+     */
+    void broadcast(const std::shared_ptr<const std::string>& msgPtr, const std::vector<TcpConnectionPtr>& conns);
+
+    /**
+     * @brief Send the same data to all the connections to the server, see
+     * broadcast(const std::shared_ptr<const std::string>&, const
+     * std::vector<TcpConnectionPtr>&).
+     *
+     * @param msgPtr
+     * @note The connections are collected in the event loop of the server, so
+     * if this method is called in another thread, the data may be sent after
+     * the data sent to the same connections later by that thread.
+     */
+    void broadcast(const std::shared_ptr<const std::string>& msgPtr);
+
+    /**
+     * @brief Collect the statistics of the connections to the server, sample
+     * their kernel state, and pass the first n of them by the rank to the
+     * callback, e.g. the connections with the most data queued to find the
+     * slow consumers.
+     *
+     * @param n
+     * @param rank
+     * @param callback Called in the thread of the event loop of the server.
+     */
+    void reportConnections(size_t n, TcpConnectionRank rank,
+                           std::function<void(std::vector<TcpConnectionReport>&&)> callback);
+
+    /**
+     * @brief Format a report of reportConnections() as a table with one line
+     * per connection, e.g. to be logged.
+     *
+     * @param reports
+     * @return std::string
+     */
+    static std::string formatReports(const std::vector<TcpConnectionReport>& reports);
+
     /**
      * @brief An idle connection is a connection that has no read or write, kick
      * off it after timeout seconds.
@@ -201,6 +284,139 @@ public:
         });
     }
 
+    /**
+     * @brief Register the sockets of connections to the server in
+     * edge-triggered mode, see TcpConnectionImpl::enableEdgeTriggered().
+     * Connections in event loops that don't use epoll stay level-triggered.
+     *
+     */
+    void enableEdgeTriggered() {
+        loop_->runInLoop([this]() {
+            assert(!started_);
+            edgeTriggered_ = true;
+        });
+    }
+
+    /**
+     * @brief Prefer to hand new connections to an I/O event loop on the NUMA
+     * node of the CPU that received their packets (SO_INCOMING_CPU), which is
+     * usually the node the NIC is attached to. Connections fall back to the
+     * round-robin dispatch if no loop is on that node, see
+     * EventLoop::numaNode().
+     *
+     */
+    void enableNumaAwareAccept() {
+        loop_->runInLoop([this]() {
+            assert(!started_);
+            numaAwareAccept_ = true;
+        });
+    }
+
+    /**
+     * @brief Set SO_BUSY_POLL on the sockets of connections to the server. It
+     * is usually combined with the spin mode of the I/O event loops, see
+     * EventLoop::setSpinDuration().
+     *
+     * @param usec The time in microseconds to busy poll the device queue.
+     */
+    void setBusyPoll(int usec) {
+        loop_->runInLoop([this, usec]() {
+            assert(!started_);
+            busyPollUs_ = usec;
+        });
+    }
+
+    /**
+     * @brief Release the read buffers of the connections to the server that
+     * receive no data for a while, see TcpConnection::setReadBufferIdleTime().
+     *
+     * @param seconds
+     */
+    void setReadBufferIdleTime(double seconds) {
+        loop_->runInLoop([this, seconds]() {
+            assert(!started_);
+            readBufferIdleTime_ = seconds;
+        });
+    }
+
+    /**
+     * @brief Read the data of the connections to the server in batches, see
+     * TcpConnection::setReadBatchBytes().
+     *
+     * @param bytes
+     */
+    void setReadBatchBytes(size_t bytes) {
+        loop_->runInLoop([this, bytes]() {
+            assert(!started_);
+            readBatchBytes_ = bytes;
+        });
+    }
+
+    /**
+     * @brief Coalesce the small sends on the connections to the server in
+     * each loop iteration, see TcpConnection::setAutoCork().
+     *
+     * @param on
+     */
+    void setAutoCork(bool on) {
+        loop_->runInLoop([this, on]() {
+            assert(!started_);
+            autoCork_ = on;
+        });
+    }
+
+    /**
+     * @brief Limit the total rates of reading and writing of all the
+     * connections to the server, which share one token bucket per direction
+     * across the I/O loops.
+     *
+     * @param readBytesPerSecond 0 for no limit on reading.
+     * @param writeBytesPerSecond 0 for no limit on writing.
+     * @param burstBytes One tenth of the rate if 0, see
+     * TcpConnection::setRateLimit().
+     */
+    void setRateLimit(size_t readBytesPerSecond, size_t writeBytesPerSecond, size_t burstBytes = 0) {
+        loop_->runInLoop([this, readBytesPerSecond, writeBytesPerSecond, burstBytes]() {
+            assert(!started_);
+            readBucket_ =
+                readBytesPerSecond > 0 ? std::make_shared<TokenBucket>(readBytesPerSecond, burstBytes) : nullptr;
+            writeBucket_ =
+                writeBytesPerSecond > 0 ? std::make_shared<TokenBucket>(writeBytesPerSecond, burstBytes) : nullptr;
+        });
+    }
+
+    /**
+     * @brief Limit the rates of reading and writing of each connection to the
+     * server, see TcpConnection::setRateLimit().
+     *
+     * @param readBytesPerSecond
+     * @param writeBytesPerSecond
+     * @param burstBytes
+     */
+    void setConnectionRateLimit(size_t readBytesPerSecond, size_t writeBytesPerSecond, size_t burstBytes = 0) {
+        loop_->runInLoop([this, readBytesPerSecond, writeBytesPerSecond, burstBytes]() {
+            assert(!started_);
+            connReadRate_ = readBytesPerSecond;
+            connWriteRate_ = writeBytesPerSecond;
+            connRateBurst_ = burstBytes;
+        });
+    }
+
+    /**
+     * @brief Watch the event loops of the server with a LoopWatchdog, which
+     * reports the loops stuck in a callback longer than the threshold.
+     *
+     * @param threshold
+     * @param dumpBacktrace If true, the backtrace of the stuck thread is
+     * written to stderr.
+     */
+    void enableWatchdog(const std::chrono::milliseconds& threshold, bool dumpBacktrace = false) {
+        loop_->runInLoop([this, threshold, dumpBacktrace]() {
+            assert(!started_);
+            watchdogPtr_ = std::make_unique<LoopWatchdog>(threshold, dumpBacktrace);
+        });
+    }
+
     /**
      * @brief Enable SSL encryption.
      *
@@ -227,6 +443,7 @@ public:
 private:
     void handleCloseInLoop(const TcpConnectionPtr& connectionPtr);
     void newConnection(int fd, const InetAddress& peer);
+    EventLoop* getNextIoLoop(int fd);
     void connectionClosed(const TcpConnectionPtr& connectionPtr);
 
     EventLoop* loop_;
@@ -239,6 +456,27 @@ private:
     WriteCompleteCallback writeCompleteCallback_;
 
     size_t idleTimeout_{0};
+    bool edgeTriggered_{false};
+    int busyPollUs_{0};
+    double readBufferIdleTime_{0};
+    size_t readBatchBytes_{0};
+    bool autoCork_{false};
+    bool numaAwareAccept_{false};
+    // The token buckets shared by all the connections, and the limits of each
+    // connection, no limit if null or 0.
+    std::shared_ptr<TokenBucket> readBucket_;
+    std::shared_ptr<TokenBucket> writeBucket_;
+    size_t connReadRate_{0};
+    size_t connWriteRate_{0};
+    size_t connRateBurst_{0};
+
+    struct NumaLoops {
+        std::vector<EventLoop*> loops;
+        size_t nextLoopIdx{0};
+    };
+    // The I/O event loops grouped by their NUMA nodes, only used by the NUMA
+    // aware dispatch.
+    std::map<int, NumaLoops> numaLoopsMap_;
     std::map<EventLoop*, std::shared_ptr<TimingWheel>> timingWheelMap_;
 
     // `loopPoolPtr_` may and may not hold the internal thread pool.
@@ -249,6 +487,8 @@ private:
     // called, `ioLoops_` will hold the loops passed in.
     // Otherwise, it should contain only one element, which is `loop_`.
     std::vector<EventLoop*> ioLoops_;
+    // Destroyed before `loopPoolPtr_`, so it stops watching the loops first.
+    std::unique_ptr<LoopWatchdog> watchdogPtr_;
     size_t nextLoopIdx_{0};
     size_t numIoLoops_{0};
 
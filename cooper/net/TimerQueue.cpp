@@ -61,10 +61,15 @@ void TimerQueue::handleRead() {
     // safe to callback outside critical section
     for (auto const& timerPtr : expired) {
         if (timerIdSet_.find(timerPtr->id()) != timerIdSet_.end()) {
+            auto start = std::chrono::steady_clock::now();
+            loop_->setActivity(LoopActivity::kRunningTimer, timerPtr->id());
             timerPtr->run();
+            auto end = std::chrono::steady_clock::now();
+            callbackTimeUs_.add(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
         }
     }
     callingExpiredTimers_ = false;
+    loop_->setActivity(LoopActivity::kHandlingEvent, timerfd_);
 
     reset(expired, now);
 }
@@ -8,6 +8,7 @@
 
 #include "cooper/net/CallBacks.hpp"
 #include "cooper/net/Timer.hpp"
+#include "cooper/util/Histogram.hpp"
 #include "cooper/util/NonCopyable.hpp"
 namespace cooper {
 // class Timer;
@@ -29,6 +30,9 @@ public:
     void addTimerInLoop(const TimerPtr& timer);
     void invalidateTimer(TimerId id);
     void reset();
+    const Log2Histogram& callbackTimeUs() const {
+        return callbackTimeUs_;
+    }
 
 protected:
     EventLoop* loop_;
@@ -45,6 +49,7 @@ protected:
 
 private:
     std::unordered_set<uint64_t> timerIdSet_;
+    Log2Histogram callbackTimeUs_;
 };
 }  // namespace cooper
 
@@ -0,0 +1,122 @@
+#include "BufferPool.hpp"
+
+#include <new>
+
+namespace cooper {
+thread_local BufferPool* t_poolInThisThread = nullptr;
+
+static size_t sizeClassOf(size_t size) {
+    return (size + BufferPool::kBlockAlignment - 1) / BufferPool::kBlockAlignment - 1;
+}
+
+BufferPool::BufferPool() : threadLocalPoolPtr_(&t_poolInThisThread) {
+    if (t_poolInThisThread == nullptr) {
+        t_poolInThisThread = this;
+    }
+}
+
+BufferPool::~BufferPool() {
+    // The pool may be destroyed in another thread, so reset the pointer of its
+    // own thread.
+    if (*threadLocalPoolPtr_ == this) {
+        *threadLocalPoolPtr_ = nullptr;
+    }
+    for (auto& blocks : blocks_) {
+        for (void* block : blocks) {
+            ::operator delete(block);
+        }
+    }
+}
+
+void BufferPool::moveToCurrentThread() {
+    if (threadLocalPoolPtr_ == &t_poolInThisThread) {
+        return;
+    }
+    if (*threadLocalPoolPtr_ == this) {
+        *threadLocalPoolPtr_ = nullptr;
+    }
+    threadLocalPoolPtr_ = &t_poolInThisThread;
+    if (t_poolInThisThread == nullptr) {
+        t_poolInThisThread = this;
+    }
+}
+
+BufferPool* BufferPool::current() {
+    return t_poolInThisThread;
+}
+
+void* BufferPool::allocate(size_t size) {
+    auto pool = t_poolInThisThread;
+    if (size == 0 || size > kMaxBlockSize) {
+        return ::operator new(size);
+    }
+    size_t sizeClass = sizeClassOf(size);
+    if (pool) {
+        auto& blocks = pool->blocks_[sizeClass];
+        if (!blocks.empty()) {
+            void* block = blocks.back();
+            blocks.pop_back();
+            pool->cachedBlocks_.store(pool->cachedBlocks_.load(std::memory_order_relaxed) - 1,
+                                      std::memory_order_relaxed);
+            increase(pool->blockReuses_);
+            return block;
+        }
+        increase(pool->blockAllocs_);
+    }
+    // Always allocate the whole size class, so the block can be reused for
+    // any size in it.
+    return ::operator new((sizeClass + 1) * kBlockAlignment);
+}
+
+void BufferPool::deallocate(void* ptr, size_t size) {
+    auto pool = t_poolInThisThread;
+    if (pool && size > 0 && size <= kMaxBlockSize) {
+        auto& blocks = pool->blocks_[sizeClassOf(size)];
+        if (blocks.size() < kMaxCachedBlocks) {
+            blocks.push_back(ptr);
+            pool->cachedBlocks_.store(pool->cachedBlocks_.load(std::memory_order_relaxed) + 1,
+                                      std::memory_order_relaxed);
+            return;
+        }
+    }
+    ::operator delete(ptr);
+}
+
+std::unique_ptr<MsgBuffer> BufferPool::acquireBuffer() {
+    auto pool = t_poolInThisThread;
+    if (pool) {
+        if (!pool->buffers_.empty()) {
+            auto buffer = std::move(pool->buffers_.back());
+            pool->buffers_.pop_back();
+            pool->cachedBuffers_.store(pool->buffers_.size(), std::memory_order_relaxed);
+            increase(pool->bufferReuses_);
+            return buffer;
+        }
+        increase(pool->bufferAllocs_);
+    }
+    return std::make_unique<MsgBuffer>();
+}
+
+void BufferPool::releaseBuffer(std::unique_ptr<MsgBuffer>&& buffer) {
+    auto pool = t_poolInThisThread;
+    if (pool && buffer && buffer->capacity() <= kMaxBufferCapacity && pool->buffers_.size() < kMaxCachedBuffers) {
+        buffer->retrieveAll();
+        pool->buffers_.push_back(std::move(buffer));
+        pool->cachedBuffers_.store(pool->buffers_.size(), std::memory_order_relaxed);
+        return;
+    }
+    buffer.reset();
+}
+
+BufferPoolStats BufferPool::stats() const {
+    BufferPoolStats stats;
+    stats.blockAllocs = blockAllocs_.load(std::memory_order_relaxed);
+    stats.blockReuses = blockReuses_.load(std::memory_order_relaxed);
+    stats.bufferAllocs = bufferAllocs_.load(std::memory_order_relaxed);
+    stats.bufferReuses = bufferReuses_.load(std::memory_order_relaxed);
+    stats.cachedBlocks = cachedBlocks_.load(std::memory_order_relaxed);
+    stats.cachedBuffers = cachedBuffers_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+}  // namespace cooper
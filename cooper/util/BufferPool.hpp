@@ -0,0 +1,169 @@
+#ifndef util_BufferPool_hpp
+#define util_BufferPool_hpp
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "cooper/util/MsgBuffer.hpp"
+#include "cooper/util/NonCopyable.hpp"
+
+namespace cooper {
+/**
+ * @brief The statistics of a buffer pool.
+ *
+ */
+struct BufferPoolStats {
+    // The number of blocks allocated from the heap and reused from the pool.
+    uint64_t blockAllocs{0};
+    uint64_t blockReuses{0};
+    // The number of message buffers allocated from the heap and reused from
+    // the pool.
+    uint64_t bufferAllocs{0};
+    uint64_t bufferReuses{0};
+    // The number of blocks and message buffers cached in the pool.
+    size_t cachedBlocks{0};
+    size_t cachedBuffers{0};
+};
+
+/**
+ * @brief This class caches the small memory blocks and the message buffers
+ * released in a thread, so that the objects allocated and released at a high
+ * rate, such as the nodes of the write queues of connections, don't go to the
+ * heap every time. An event loop owns the pool of its thread.
+ * @note The static methods use the pool of the current thread, and fall back
+ * to the heap in a thread without a pool. A block or buffer can be released
+ * in any thread, it is cached by the pool of that thread.
+ */
+class BufferPool : NonCopyable {
+public:
+    // Blocks are cached in size classes of kBlockAlignment bytes up to
+    // kMaxBlockSize bytes, larger ones always go to the heap.
+    static constexpr size_t kBlockAlignment = 64;
+    static constexpr size_t kMaxBlockSize = 512;
+    static constexpr size_t kMaxCachedBlocks = 256;
+    // Message buffers that have grown larger are released to the heap.
+    static constexpr size_t kMaxBufferCapacity = 64 * 1024;
+    static constexpr size_t kMaxCachedBuffers = 64;
+
+    /**
+     * @brief Construct the pool of the current thread, which is not used if
+     * the thread already has one.
+     *
+     */
+    BufferPool();
+    ~BufferPool();
+
+    /**
+     * @brief Make the pool the one of the current thread instead of the one
+     * it was constructed in, unless the current thread already has one, see
+     * EventLoop::moveToCurrentThread(). The pool must not be used in the old
+     * thread any more.
+     *
+     */
+    void moveToCurrentThread();
+
+    /**
+     * @brief Return the pool of the current thread, nullptr if there isn't.
+     *
+     * @return BufferPool*
+     */
+    static BufferPool* current();
+
+    /**
+     * @brief Allocate a block of memory.
+     *
+     * @param size
+     * @return void*
+     */
+    static void* allocate(size_t size);
+
+    /**
+     * @brief Release a block allocated by allocate().
+     *
+     * @param ptr
+     * @param size The size passed to allocate().
+     */
+    static void deallocate(void* ptr, size_t size);
+
+    /**
+     * @brief Get an empty message buffer.
+     *
+     * @return std::unique_ptr<MsgBuffer>
+     */
+    static std::unique_ptr<MsgBuffer> acquireBuffer();
+
+    /**
+     * @brief Release a message buffer, the data in it is discarded.
+     *
+     * @param buffer
+     */
+    static void releaseBuffer(std::unique_ptr<MsgBuffer>&& buffer);
+
+    /**
+     * @brief Return the statistics of the pool. This method can be called in
+     * any thread.
+     *
+     * @return BufferPoolStats
+     */
+    BufferPoolStats stats() const;
+
+private:
+    static constexpr size_t kSizeClasses = kMaxBlockSize / kBlockAlignment;
+
+    static void increase(std::atomic<uint64_t>& counter) {
+        // Only the thread of the pool writes the counters.
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    std::array<std::vector<void*>, kSizeClasses> blocks_;
+    std::vector<std::unique_ptr<MsgBuffer>> buffers_;
+    std::atomic<uint64_t> blockAllocs_{0};
+    std::atomic<uint64_t> blockReuses_{0};
+    std::atomic<uint64_t> bufferAllocs_{0};
+    std::atomic<uint64_t> bufferReuses_{0};
+    std::atomic<size_t> cachedBlocks_{0};
+    std::atomic<size_t> cachedBuffers_{0};
+    BufferPool** threadLocalPoolPtr_;
+};
+
+/**
+ * @brief An allocator on the blocks of BufferPool, e.g. to make objects
+ * managed by std::shared_ptr together with their control blocks with
+ * std::allocate_shared().
+ *
+ * @tparam T
+ */
+template <typename T>
+class PoolAllocator {
+public:
+    using value_type = T;
+
+    PoolAllocator() = default;
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&) noexcept {
+    }
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(BufferPool::allocate(n * sizeof(T)));
+    }
+    void deallocate(T* ptr, size_t n) noexcept {
+        BufferPool::deallocate(ptr, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>&) const noexcept {
+        return true;
+    }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>&) const noexcept {
+        return false;
+    }
+};
+
+}  // namespace cooper
+
+#endif
@@ -0,0 +1,162 @@
+#include "CpuAffinity.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#include "cooper/util/Logger.hpp"
+
+namespace cooper {
+
+namespace {
+std::string readFirstLine(const std::string& path) {
+    std::ifstream file(path);
+    std::string line;
+    if (file) {
+        std::getline(file, line);
+    }
+    return line;
+}
+
+// The NUMA node of every CPU, read from sysfs once.
+const std::vector<int>& cpuToNodeTable() {
+    static const std::vector<int> table = []() {
+        std::vector<int> nodeOfCpu;
+        for (int node : utils::numaNodes()) {
+            for (int cpu : utils::cpusOfNumaNode(node)) {
+                if (static_cast<size_t>(cpu) >= nodeOfCpu.size()) {
+                    nodeOfCpu.resize(cpu + 1, -1);
+                }
+                nodeOfCpu[cpu] = node;
+            }
+        }
+        return nodeOfCpu;
+    }();
+    return table;
+}
+}  // namespace
+
+CpuAffinityPolicy CpuAffinityPolicy::cores(std::vector<int> cpus) {
+    CpuAffinityPolicy policy;
+    policy.kind_ = cpus.empty() ? Kind::kNone : Kind::kCores;
+    policy.ids_ = std::move(cpus);
+    return policy;
+}
+
+CpuAffinityPolicy CpuAffinityPolicy::roundRobin(std::vector<int> cpuset) {
+    if (cpuset.empty()) {
+        cpuset = utils::allowedCpus();
+    }
+    return cores(std::move(cpuset));
+}
+
+CpuAffinityPolicy CpuAffinityPolicy::numaLocal(std::vector<int> nodes) {
+    if (nodes.empty()) {
+        nodes = utils::numaNodes();
+    }
+    CpuAffinityPolicy policy;
+    if (nodes.empty()) {
+        LOG_WARN << "No NUMA information available, threads are not pinned";
+        return policy;
+    }
+    policy.kind_ = Kind::kNumaLocal;
+    policy.ids_ = std::move(nodes);
+    return policy;
+}
+
+std::vector<int> CpuAffinityPolicy::cpusForThread(size_t index) const {
+    switch (kind_) {
+        case Kind::kCores:
+            return {ids_[index % ids_.size()]};
+        case Kind::kNumaLocal:
+            return utils::cpusOfNumaNode(ids_[index % ids_.size()]);
+        default:
+            return {};
+    }
+}
+
+namespace utils {
+std::vector<int> parseCpuList(const std::string& list) {
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        std::string range = list.substr(pos, end - pos);
+        pos = end + 1;
+        if (range.empty()) {
+            continue;
+        }
+        size_t dash = range.find('-');
+        int first = atoi(range.c_str());
+        int last = dash == std::string::npos ? first : atoi(range.c_str() + dash + 1);
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+std::vector<int> allowedCpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) < 0) {
+        LOG_SYSERR << "sched_getaffinity";
+        return cpus;
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &set)) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+std::vector<int> numaNodes() {
+    return parseCpuList(readFirstLine("/sys/devices/system/node/online"));
+}
+
+std::vector<int> cpusOfNumaNode(int node) {
+    return parseCpuList(readFirstLine("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"));
+}
+
+int numaNodeOfCpu(int cpu) {
+    const auto& table = cpuToNodeTable();
+    if (cpu < 0 || static_cast<size_t>(cpu) >= table.size()) {
+        return -1;
+    }
+    return table[cpu];
+}
+
+int numaNodeOfNetDevice(const std::string& ifname) {
+    std::string node = readFirstLine("/sys/class/net/" + ifname + "/device/numa_node");
+    if (node.empty()) {
+        return -1;
+    }
+    return atoi(node.c_str());
+}
+
+bool setCurrentThreadAffinity(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (ret != 0) {
+        LOG_ERROR << "pthread_setaffinity_np failed: " << strerror(ret);
+        return false;
+    }
+    return true;
+}
+}  // namespace utils
+
+}  // namespace cooper
@@ -0,0 +1,127 @@
+#ifndef util_CpuAffinity_hpp
+#define util_CpuAffinity_hpp
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace cooper {
+/**
+ * @brief This class describes how the threads of an EventLoopThreadPool are
+ * placed on CPUs. The i-th thread of the pool is pinned to the CPUs returned by
+ * cpusForThread(i).
+ *
+ */
+class CpuAffinityPolicy {
+public:
+    /**
+     * @brief Construct a policy that doesn't pin threads.
+     *
+     */
+    CpuAffinityPolicy() = default;
+
+    /**
+     * @brief Pin the i-th thread to cpus[i % cpus.size()].
+     *
+     * @param cpus The explicit list of CPUs.
+     * @return CpuAffinityPolicy
+     */
+    static CpuAffinityPolicy cores(std::vector<int> cpus);
+
+    /**
+     * @brief Pin threads one by one to the CPUs of a cpuset in a round-robin
+     * way.
+     *
+     * @param cpuset The CPUs to use, all CPUs the process is allowed to run on
+     * if empty.
+     * @return CpuAffinityPolicy
+     */
+    static CpuAffinityPolicy roundRobin(std::vector<int> cpuset = {});
+
+    /**
+     * @brief Spread threads over NUMA nodes in a round-robin way. Every thread
+     * is allowed to run on all CPUs of its node, so the scheduler can still
+     * balance the load inside the node.
+     *
+     * @param nodes The NUMA nodes to use, all online nodes if empty.
+     * @return CpuAffinityPolicy
+     */
+    static CpuAffinityPolicy numaLocal(std::vector<int> nodes = {});
+
+    /**
+     * @brief Return the CPUs the index-th thread should be pinned to. An empty
+     * vector means the thread is not pinned.
+     *
+     * @param index
+     * @return std::vector<int>
+     */
+    std::vector<int> cpusForThread(size_t index) const;
+
+private:
+    enum class Kind { kNone, kCores, kNumaLocal };
+    Kind kind_{Kind::kNone};
+    // CPUs for kCores, nodes for kNumaLocal.
+    std::vector<int> ids_;
+};
+
+namespace utils {
+/**
+ * @brief Parse a CPU or node list in the format of sysfs and cpuset, such as
+ * "0-3,8,10-11".
+ *
+ * @param list
+ * @return std::vector<int>
+ */
+std::vector<int> parseCpuList(const std::string& list);
+
+/**
+ * @brief Return the CPUs the current process is allowed to run on.
+ *
+ * @return std::vector<int>
+ */
+std::vector<int> allowedCpus();
+
+/**
+ * @brief Return the online NUMA nodes, an empty vector if the system has no
+ * NUMA information.
+ *
+ * @return std::vector<int>
+ */
+std::vector<int> numaNodes();
+
+/**
+ * @brief Return the CPUs of a NUMA node.
+ *
+ * @param node
+ * @return std::vector<int>
+ */
+std::vector<int> cpusOfNumaNode(int node);
+
+/**
+ * @brief Return the NUMA node of a CPU, -1 if unknown.
+ *
+ * @param cpu
+ * @return int
+ */
+int numaNodeOfCpu(int cpu);
+
+/**
+ * @brief Return the NUMA node a network device is attached to, -1 if unknown.
+ *
+ * @param ifname The name of the device, such as "eth0".
+ * @return int
+ */
+int numaNodeOfNetDevice(const std::string& ifname);
+
+/**
+ * @brief Pin the current thread to the given CPUs.
+ *
+ * @param cpus
+ * @return true if successful, false otherwise
+ */
+bool setCurrentThreadAffinity(const std::vector<int>& cpus);
+}  // namespace utils
+
+}  // namespace cooper
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef util_Histogram_hpp
+#define util_Histogram_hpp
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace cooper {
+/**
+ * @brief This class represents a histogram with power-of-two buckets. Bucket 0
+ * counts the value 0, and bucket i counts the values in [2^(i-1), 2^i), the
+ * last bucket also counts all larger values.
+ * @note The histogram has a single writer and can be read in any thread
+ * without locking.
+ */
+class Log2Histogram {
+public:
+    static constexpr size_t kBuckets = 32;
+    using Buckets = std::array<uint64_t, kBuckets>;
+
+    /**
+     * @brief Count a value. This method must be called in a single thread.
+     *
+     * @param value
+     */
+    void add(uint64_t value) {
+        auto& bucket = buckets_[bucketOf(value)];
+        // Only one thread writes, so there is no need for a read-modify-write
+        // operation.
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Return a copy of the counts of the buckets.
+     *
+     * @return Buckets
+     */
+    Buckets snapshot() const {
+        Buckets buckets;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+        }
+        return buckets;
+    }
+
+    /**
+     * @brief Return the bucket of a value.
+     *
+     * @param value
+     * @return size_t
+     */
+    static size_t bucketOf(uint64_t value) {
+        size_t bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+        return bucket < kBuckets ? bucket : kBuckets - 1;
+    }
+
+    /**
+     * @brief Return the upper bound of the bucket that contains the given
+     * percentile of the counted values, 0 if no value is counted.
+     *
+     * @param buckets
+     * @param percentile A number in [0, 1].
+     * @return uint64_t
+     */
+    static uint64_t percentile(const Buckets& buckets, double percentile) {
+        uint64_t total = 0;
+        for (auto count : buckets) {
+            total += count;
+        }
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(percentile * total);
+        if (rank >= total) {
+            rank = total - 1;
+        }
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            seen += buckets[i];
+            if (seen > rank) {
+                return i == 0 ? 0 : (static_cast<uint64_t>(1) << i) - 1;
+            }
+        }
+        return (static_cast<uint64_t>(1) << (kBuckets - 1)) - 1;
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, kBuckets> buckets_{};
+};
+
+}  // namespace cooper
+
+#endif
@@ -103,20 +103,33 @@ void MsgBuffer::retrieve(size_t len) {
     head_ += len;
 }
 void MsgBuffer::retrieveAll() {
-    if (buffer_.size() > (initCap_ * 2)) {
-        buffer_.resize(initCap_);
-    }
+    // Resizing the buffer down doesn't release the memory, and the space
+    // would be filled with zeros again when it grows, so keep the size, see
+    // shrink().
     tail_ = head_ = kBufferOffset;
 }
+void MsgBuffer::shrink(size_t len) {
+    size_t readable = readableBytes();
+    if (len < readable)
+        len = readable;
+    std::vector<char> buffer(len + kBufferOffset);
+    std::copy(begin() + head_, begin() + tail_, buffer.begin() + kBufferOffset);
+    buffer_.swap(buffer);
+    head_ = kBufferOffset;
+    tail_ = kBufferOffset + readable;
+}
 ssize_t MsgBuffer::readFd(int fd, int* retErrno) {
     char extBuffer[8192];
+    return readFd(fd, retErrno, extBuffer, writableBytes() < sizeof(extBuffer) ? sizeof(extBuffer) : 0);
+}
+ssize_t MsgBuffer::readFd(int fd, int* retErrno, char* extBuffer, size_t extLength) {
     struct iovec vec[2];
     size_t writable = writableBytes();
     vec[0].iov_base = begin() + tail_;
-    vec[0].iov_len = static_cast<int>(writable);
+    vec[0].iov_len = writable;
     vec[1].iov_base = extBuffer;
-    vec[1].iov_len = sizeof(extBuffer);
-    const int iovcnt = (writable < sizeof extBuffer) ? 2 : 1;
+    vec[1].iov_len = extLength;
+    const int iovcnt = extLength > 0 ? 2 : 1;
     ssize_t n = ::readv(fd, vec, iovcnt);
     if (n < 0) {
         *retErrno = errno;
@@ -149,6 +149,16 @@ public:
         return buffer_.size() - tail_;
     }
 
+    /**
+     * @brief Return the size of the memory held by the buffer, which is only
+     * released by shrink().
+     *
+     * @return size_t
+     */
+    size_t capacity() const {
+        return buffer_.capacity();
+    }
+
     /**
      * @brief Append new data to the buffer.
      *
@@ -245,6 +255,16 @@ public:
      */
     void retrieve(size_t len);
 
+    /**
+     * @brief Reallocate the buffer with the space for len bytes, or for the
+     * data in it if there is more, to release the memory of a buffer that has
+     * grown for a burst of data. 0 releases all the memory of an empty
+     * buffer, which grows again when data is appended.
+     *
+     * @param len
+     */
+    void shrink(size_t len);
+
     /**
      * @brief Read data from a file descriptor and put it into the buffer.˝
      *
@@ -255,6 +275,21 @@ public:
      */
     ssize_t readFd(int fd, int* retErrno);
 
+    /**
+     * @brief Read data from a file descriptor into the empty part of the
+     * buffer and then the extra memory with one system call, the data in the
+     * extra memory is appended to the buffer.
+     *
+     * @param fd The file descriptor. It is usually a socket.
+     * @param retErrno The error code when reading.
+     * @param extBuffer The extra memory.
+     * @param extLength The size of the extra memory, 0 to read only into the
+     * buffer.
+     * @return ssize_t The number of bytes read from the file descriptor. -1 is
+     * returned when an error occurs.
+     */
+    ssize_t readFd(int fd, int* retErrno, char* extBuffer, size_t extLength);
+
     /**
      * @brief Remove the data before a certain position from the buffer.
      *
@@ -0,0 +1,161 @@
+#include "RingBuffer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+using namespace cooper;
+
+static size_t roundUpToPowerOfTwo(size_t len) {
+    size_t cap = 1;
+    while (cap < len)
+        cap <<= 1;
+    return cap;
+}
+
+RingBuffer::RingBuffer(size_t len) {
+    if (len > 0)
+        reallocate(len);
+}
+
+const char* RingBuffer::linearize(size_t len) const {
+    // The view starts at the first readable byte, so a longer one can be used
+    // for a shorter length until some data is retrieved. The memory for all
+    // the readable data is reserved at once, so that a longer view doesn't
+    // move the view returned before.
+    if (view_.size() < len) {
+        size_t first = capacity_ - head_;
+        if (view_.capacity() < size_) {
+            view_.reserve(size_);
+        }
+        view_.resize(len);
+        memcpy(view_.data(), buffer_.get() + head_, first);
+        memcpy(view_.data() + first, buffer_.get(), len - first);
+    }
+    return view_.data();
+}
+
+int RingBuffer::peekSegments(struct iovec* vec) const {
+    if (size_ == 0)
+        return 0;
+    size_t first = std::min(size_, capacity_ - head_);
+    vec[0].iov_base = buffer_.get() + head_;
+    vec[0].iov_len = first;
+    if (first == size_)
+        return 1;
+    vec[1].iov_base = buffer_.get();
+    vec[1].iov_len = size_ - first;
+    return 2;
+}
+
+void RingBuffer::append(const char* buf, size_t len) {
+    if (len == 0)
+        return;
+    ensureWritableBytes(len);
+    size_t tail = (head_ + size_) & mask();
+    size_t first = std::min(len, capacity_ - tail);
+    memcpy(buffer_.get() + tail, buf, first);
+    memcpy(buffer_.get(), buf + first, len - first);
+    size_ += len;
+}
+
+void RingBuffer::retrieveAll() {
+    // Starting over at the beginning of the ring keeps the next data
+    // contiguous as long as possible.
+    head_ = size_ = 0;
+    view_.clear();
+}
+
+std::string RingBuffer::read(size_t len) {
+    if (len > size_)
+        len = size_;
+    std::string ret(peek(len), len);
+    retrieve(len);
+    return ret;
+}
+
+const char* RingBuffer::find(const std::string& str) const {
+    const char* begin = peek();
+    const char* end = begin + size_;
+    const char* ret = std::search(begin, end, std::begin(str), std::end(str));
+    return ret == end ? NULL : ret;
+}
+
+void RingBuffer::ensureWritableBytes(size_t len) {
+    if (writableBytes() >= len)
+        return;
+    reallocate(std::max(capacity_ * 2, size_ + len));
+}
+
+void RingBuffer::shrink(size_t len) {
+    if (len == 0 && size_ == 0) {
+        buffer_.reset();
+        capacity_ = head_ = 0;
+        view_ = std::vector<char>();
+        return;
+    }
+    reallocate(len);
+    view_.shrink_to_fit();
+}
+
+void RingBuffer::reallocate(size_t len) {
+    size_t cap = roundUpToPowerOfTwo(std::max(len, size_));
+    std::unique_ptr<char[]> buffer(new char[cap]);
+    struct iovec vec[2];
+    int count = peekSegments(vec);
+    size_t offset = 0;
+    for (int i = 0; i < count; ++i) {
+        memcpy(buffer.get() + offset, vec[i].iov_base, vec[i].iov_len);
+        offset += vec[i].iov_len;
+    }
+    buffer_.swap(buffer);
+    capacity_ = cap;
+    head_ = 0;
+    view_.clear();
+}
+
+ssize_t RingBuffer::readFd(int fd, int* retErrno) {
+    char extBuffer[8192];
+    return readFd(fd, retErrno, extBuffer, writableBytes() < sizeof(extBuffer) ? sizeof(extBuffer) : 0);
+}
+
+ssize_t RingBuffer::readFd(int fd, int* retErrno, char* extBuffer, size_t extLength) {
+    struct iovec vec[3];
+    int iovcnt = 0;
+    size_t writable = writableBytes();
+    if (writable > 0) {
+        size_t tail = (head_ + size_) & mask();
+        size_t first = std::min(writable, capacity_ - tail);
+        vec[iovcnt].iov_base = buffer_.get() + tail;
+        vec[iovcnt].iov_len = first;
+        ++iovcnt;
+        if (writable > first) {
+            vec[iovcnt].iov_base = buffer_.get();
+            vec[iovcnt].iov_len = writable - first;
+            ++iovcnt;
+        }
+    }
+    if (extLength > 0) {
+        vec[iovcnt].iov_base = extBuffer;
+        vec[iovcnt].iov_len = extLength;
+        ++iovcnt;
+    }
+    ssize_t n = ::readv(fd, vec, iovcnt);
+    if (n < 0) {
+        *retErrno = errno;
+    } else if (static_cast<size_t>(n) <= writable) {
+        size_ += n;
+    } else {
+        size_ = capacity_;
+        append(extBuffer, n - writable);
+    }
+    return n;
+}
+
+void RingBuffer::swap(RingBuffer& buf) noexcept {
+    buffer_.swap(buf.buffer_);
+    std::swap(capacity_, buf.capacity_);
+    std::swap(head_, buf.head_);
+    std::swap(size_, buf.size_);
+    view_.swap(buf.view_);
+}
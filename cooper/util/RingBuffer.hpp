@@ -0,0 +1,240 @@
+#ifndef util_RingBuffer_hpp
+#define util_RingBuffer_hpp
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cooper/util/MsgBuffer.hpp"
+
+namespace cooper {
+/**
+ * @brief This class represents a memory buffer for receiving data, which has
+ * the same peek()/retrieve()/append()/readFd() contract as MsgBuffer but keeps
+ * the data in a ring, so the data left in it, e.g. the beginning of a
+ * pipelined message, is never moved to make room for more.
+ *
+ * The readable data is in one or two segments, see peekSegments(). A
+ * contiguous view of data that wraps around the end of the ring is given on
+ * demand by copying only the part asked for to a separate memory. The views
+ * returned by peek() stay valid, longer ones included, until data is appended
+ * to or retrieved from the buffer, or the buffer is shrunk or swapped.
+ */
+class RingBuffer {
+public:
+    /**
+     * @brief Construct a new ring buffer instance.
+     *
+     * @param len The initial size of the buffer, rounded up to a power of two.
+     */
+    explicit RingBuffer(size_t len = kBufferDefaultLength);
+
+    /**
+     * @brief Get a contiguous view of all the readable data.
+     *
+     * @return const char*
+     */
+    const char* peek() const {
+        return peek(size_);
+    }
+
+    /**
+     * @brief Get a contiguous view of the first len bytes of the readable
+     * data, which is copied only if it wraps around the end of the ring.
+     *
+     * @param len
+     * @return const char*
+     */
+    const char* peek(size_t len) const {
+        assert(len <= size_);
+        if (head_ + len <= capacity_)
+            return buffer_.get() + head_;
+        return linearize(len);
+    }
+
+    /**
+     * @brief Get the readable data as one or two segments without copying.
+     *
+     * @param vec An array of two elements.
+     * @return int The number of segments.
+     */
+    int peekSegments(struct iovec* vec) const;
+
+    /**
+     * @brief Return the size of the data in the buffer.
+     *
+     * @return size_t
+     */
+    size_t readableBytes() const {
+        return size_;
+    }
+
+    /**
+     * @brief Return the size of the empty part in the buffer, which may be in
+     * two segments.
+     *
+     * @return size_t
+     */
+    size_t writableBytes() const {
+        return capacity_ - size_;
+    }
+
+    /**
+     * @brief Return the size of the memory held by the ring.
+     *
+     * @return size_t
+     */
+    size_t capacity() const {
+        return capacity_;
+    }
+
+    /**
+     * @brief Append new data to the buffer.
+     *
+     */
+    void append(const char* buf, size_t len);
+    void append(const std::string& buf) {
+        append(buf.c_str(), buf.length());
+    }
+    void append(const MsgBuffer& buf) {
+        append(buf.peek(), buf.readableBytes());
+    }
+
+    /**
+     * @brief Remove some bytes in the buffer.
+     *
+     * @param len
+     */
+    void retrieve(size_t len) {
+        if (len >= size_) {
+            retrieveAll();
+            return;
+        }
+        head_ = (head_ + len) & mask();
+        size_ -= len;
+        view_.clear();
+    }
+
+    /**
+     * @brief Remove all data in the buffer.
+     *
+     */
+    void retrieveAll();
+
+    /**
+     * @brief Remove the data before a certain position of the view returned
+     * by peek().
+     *
+     * @param end The position.
+     */
+    void retrieveUntil(const char* end) {
+        const char* begin = peek();
+        assert(begin <= end && end <= begin + size_);
+        retrieve(end - begin);
+    }
+
+    /**
+     * @brief Get and remove some bytes from the buffer.
+     *
+     * @param len
+     * @return std::string
+     */
+    std::string read(size_t len);
+
+    /**
+     * @brief Find the position of the view returned by peek() where the data
+     * is found.
+     * @param str
+     * @return const char*
+     */
+    const char* find(const std::string& str) const;
+
+    /**
+     * @brief Find the position of the view returned by peek() where the CRLF
+     * is found.
+     *
+     * @return const char*
+     */
+    const char* findCRLF() const {
+        return find(CRLF);
+    }
+
+    /**
+     * @brief Make sure the buffer has enough space to write data, the ring is
+     * reallocated if it hasn't.
+     *
+     * @param len
+     */
+    void ensureWritableBytes(size_t len);
+
+    /**
+     * @brief Reallocate the ring with the space for len bytes, or for the data
+     * in it if there is more, see MsgBuffer::shrink().
+     *
+     * @param len
+     */
+    void shrink(size_t len);
+
+    /**
+     * @brief Read data from a file descriptor into the empty part of the
+     * ring, and into an extra memory on the stack if the empty part is small.
+     *
+     * @param fd The file descriptor. It is usually a socket.
+     * @param retErrno The error code when reading.
+     * @return ssize_t The number of bytes read from the file descriptor. -1 is
+     * returned when an error occurs.
+     */
+    ssize_t readFd(int fd, int* retErrno);
+
+    /**
+     * @brief Read data from a file descriptor into the one or two segments of
+     * the empty part of the ring and then the extra memory with one readv(),
+     * the data in the extra memory is appended to the buffer.
+     *
+     * @param fd The file descriptor. It is usually a socket.
+     * @param retErrno The error code when reading.
+     * @param extBuffer The extra memory.
+     * @param extLength The size of the extra memory, 0 to read only into the
+     * ring.
+     * @return ssize_t The number of bytes read from the file descriptor. -1 is
+     * returned when an error occurs.
+     */
+    ssize_t readFd(int fd, int* retErrno, char* extBuffer, size_t extLength);
+
+    /**
+     * @brief swap the buffer with another.
+     *
+     * @param buf
+     */
+    void swap(RingBuffer& buf) noexcept;
+
+private:
+    size_t mask() const {
+        return capacity_ - 1;
+    }
+    const char* linearize(size_t len) const;
+    void reallocate(size_t len);
+
+    std::unique_ptr<char[]> buffer_;
+    size_t capacity_{0};
+    // The index of the first readable byte and the size of the data.
+    size_t head_{0};
+    size_t size_{0};
+    // The copy of the data that wraps around the end of the ring given by
+    // peek(), cleared when data is retrieved or the ring is reallocated. Its
+    // memory is reserved for all the readable data when it is first used.
+    mutable std::vector<char> view_;
+};
+
+inline void swap(RingBuffer& one, RingBuffer& two) noexcept {
+    one.swap(two);
+}
+}  // namespace cooper
+
+#endif
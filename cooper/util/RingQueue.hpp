@@ -0,0 +1,166 @@
+#ifndef util_RingQueue_hpp
+#define util_RingQueue_hpp
+
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+namespace cooper {
+/**
+ * @brief This class template represents a FIFO queue stored in a contiguous
+ * ring buffer, which grows by doubling its capacity and so doesn't allocate
+ * memory for each item like std::list.
+ *
+ * @tparam T The type of the items, which must be default constructible and
+ * movable. The slots not in use hold default constructed items.
+ * @note Pushing an item invalidates the references to the other items if the
+ * queue grows.
+ */
+template <typename T>
+class RingQueue {
+public:
+    template <typename Queue, typename Item>
+    class Iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = Item*;
+        using reference = Item&;
+
+        Iterator(Queue* queue, size_t index) : queue_(queue), index_(index) {
+        }
+        reference operator*() const {
+            return (*queue_)[index_];
+        }
+        pointer operator->() const {
+            return &(*queue_)[index_];
+        }
+        Iterator& operator++() {
+            ++index_;
+            return *this;
+        }
+        Iterator operator++(int) {
+            Iterator tmp = *this;
+            ++index_;
+            return tmp;
+        }
+        bool operator==(const Iterator& other) const {
+            return queue_ == other.queue_ && index_ == other.index_;
+        }
+        bool operator!=(const Iterator& other) const {
+            return !(*this == other);
+        }
+
+    private:
+        Queue* queue_;
+        size_t index_;
+    };
+    using iterator = Iterator<RingQueue, T>;
+    using const_iterator = Iterator<const RingQueue, const T>;
+
+    // The capacity is kept when the queue becomes empty, unless it has grown
+    // larger than this after a burst.
+    static constexpr size_t kRetainedCapacity = 64;
+
+    bool empty() const {
+        return size_ == 0;
+    }
+    size_t size() const {
+        return size_;
+    }
+    size_t capacity() const {
+        return slots_.size();
+    }
+
+    T& operator[](size_t index) {
+        assert(index < size_);
+        return slots_[(head_ + index) & (slots_.size() - 1)];
+    }
+    const T& operator[](size_t index) const {
+        assert(index < size_);
+        return slots_[(head_ + index) & (slots_.size() - 1)];
+    }
+    T& front() {
+        return (*this)[0];
+    }
+    const T& front() const {
+        return (*this)[0];
+    }
+    T& back() {
+        return (*this)[size_ - 1];
+    }
+    const T& back() const {
+        return (*this)[size_ - 1];
+    }
+
+    iterator begin() {
+        return iterator(this, 0);
+    }
+    iterator end() {
+        return iterator(this, size_);
+    }
+    const_iterator begin() const {
+        return const_iterator(this, 0);
+    }
+    const_iterator end() const {
+        return const_iterator(this, size_);
+    }
+
+    void push_back(const T& item) {
+        push_back(T(item));
+    }
+    void push_back(T&& item) {
+        if (size_ == slots_.size()) {
+            grow();
+        }
+        slots_[(head_ + size_) & (slots_.size() - 1)] = std::move(item);
+        ++size_;
+    }
+
+    /**
+     * @brief Remove the first item.
+     * @note The item is destroyed after the queue is updated, so the
+     * destructor of the item can push new items to the queue.
+     */
+    void pop_front() {
+        assert(size_ > 0);
+        T item = std::move(slots_[head_]);
+        slots_[head_] = T();
+        head_ = (head_ + 1) & (slots_.size() - 1);
+        --size_;
+        if (size_ == 0) {
+            head_ = 0;
+            if (slots_.size() > kRetainedCapacity) {
+                std::vector<T>().swap(slots_);
+            }
+        }
+    }
+
+    void clear() {
+        while (!empty()) {
+            pop_front();
+        }
+    }
+
+private:
+    void grow() {
+        std::vector<T> slots(slots_.empty() ? 8 : slots_.size() * 2);
+        for (size_t i = 0; i < size_; ++i) {
+            slots[i] = std::move((*this)[i]);
+        }
+        slots_.swap(slots);
+        head_ = 0;
+    }
+
+    // The size of the slots is always a power of 2.
+    std::vector<T> slots_;
+    size_t head_{0};
+    size_t size_{0};
+};
+
+}  // namespace cooper
+
+#endif
@@ -0,0 +1,328 @@
+#ifndef util_TaskQueue_hpp
+#define util_TaskQueue_hpp
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+
+#include "cooper/util/NonCopyable.hpp"
+
+namespace cooper {
+/**
+ * @brief This class represents a move-only callable with no arguments. Callables
+ * up to kInlineSize bytes are stored inline, larger ones are stored on the
+ * heap.
+ *
+ */
+class Task {
+public:
+    static constexpr size_t kInlineSize = 48;
+
+    Task() = default;
+
+    template <typename F,
+              typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    Task(F&& f) {
+        using Callable = typename std::decay<F>::type;
+        if constexpr (fitsInline<Callable>()) {
+            new (storage_) Callable(std::forward<F>(f));
+            ops_ = &InlineOps<Callable>::ops;
+        } else {
+            *reinterpret_cast<Callable**>(storage_) = new Callable(std::forward<F>(f));
+            ops_ = &HeapOps<Callable>::ops;
+        }
+    }
+
+    Task(Task&& other) noexcept {
+        moveFrom(other);
+    }
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        reset();
+    }
+
+    /**
+     * @brief Call the callable.
+     *
+     */
+    void operator()() {
+        assert(ops_);
+        ops_->invoke(storage_);
+    }
+
+    explicit operator bool() const {
+        return ops_ != nullptr;
+    }
+
+    /**
+     * @brief Return the type of the callable, typeid(void) if there is none.
+     *
+     */
+    const std::type_info& targetType() const {
+        return ops_ ? *ops_->type : typeid(void);
+    }
+
+    /**
+     * @brief Destroy the callable.
+     *
+     */
+    void reset() {
+        if (ops_) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    /**
+     * @brief Return true if a callable of type F is stored inline.
+     *
+     */
+    template <typename F>
+    static constexpr bool fitsInline() {
+        return sizeof(F) <= kInlineSize && alignof(F) <= alignof(void*) &&
+               std::is_nothrow_move_constructible<F>::value;
+    }
+
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        // Move the callable from src to the uninitialized dst and destroy src.
+        void (*relocate)(void* src, void* dst);
+        void (*destroy)(void* storage);
+        const std::type_info* type;
+    };
+
+    template <typename F>
+    struct InlineOps {
+        static void invoke(void* storage) {
+            (*static_cast<F*>(storage))();
+        }
+        static void relocate(void* src, void* dst) {
+            new (dst) F(std::move(*static_cast<F*>(src)));
+            static_cast<F*>(src)->~F();
+        }
+        static void destroy(void* storage) {
+            static_cast<F*>(storage)->~F();
+        }
+        static constexpr Ops ops{invoke, relocate, destroy, &typeid(F)};
+    };
+
+    template <typename F>
+    struct HeapOps {
+        static void invoke(void* storage) {
+            (**static_cast<F**>(storage))();
+        }
+        static void relocate(void* src, void* dst) {
+            *static_cast<F**>(dst) = *static_cast<F**>(src);
+        }
+        static void destroy(void* storage) {
+            delete *static_cast<F**>(storage);
+        }
+        static constexpr Ops ops{invoke, relocate, destroy, &typeid(F)};
+    };
+
+    void moveFrom(Task& other) {
+        ops_ = other.ops_;
+        if (ops_) {
+            ops_->relocate(other.storage_, storage_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    alignas(void*) unsigned char storage_[kInlineSize];
+    const Ops* ops_{nullptr};
+};
+
+/**
+ * @brief This class represents an unbounded lock-free multiple producers
+ * single consumer queue of tasks. Tasks are stored inline in cache-line-sized
+ * slots of linked blocks, so enqueuing a task that fits in a Task doesn't
+ * allocate memory except for a new block every kBlockCap tasks, and consumed
+ * blocks are recycled.
+ * @note The algorithm is derived from the SegQueue of crossbeam.
+ */
+class TaskQueue : public NonCopyable {
+public:
+    TaskQueue() {
+        Block* block = new Block;
+        headBlock_ = block;
+        tailBlock_.store(block, std::memory_order_relaxed);
+    }
+
+    ~TaskQueue() {
+        Task task;
+        while (dequeue(task)) {
+        }
+        delete headBlock_;
+        delete spareBlock_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Put a task into the queue.
+     *
+     * @param f The callable of the task.
+     * @note This method can be called in multiple threads.
+     */
+    template <typename F>
+    void enqueue(F&& f) {
+        Block* nextBlock = nullptr;
+        size_t tail = tailIndex_.load(std::memory_order_acquire);
+        Block* block = tailBlock_.load(std::memory_order_acquire);
+        for (;;) {
+            size_t offset = tail % kLap;
+            if (offset == kBlockCap) {
+                // Another producer is installing the next block.
+                std::this_thread::yield();
+                tail = tailIndex_.load(std::memory_order_acquire);
+                block = tailBlock_.load(std::memory_order_acquire);
+                continue;
+            }
+            // Allocate the next block in advance if this producer is going to
+            // fill the last slot, so that others wait as short as possible.
+            if (offset + 1 == kBlockCap && nextBlock == nullptr) {
+                nextBlock = newBlock();
+            }
+            if (tailIndex_.compare_exchange_weak(tail, tail + 1, std::memory_order_seq_cst,
+                                                 std::memory_order_acquire)) {
+                if (offset + 1 == kBlockCap) {
+                    // Install the next block and skip the sentinel offset.
+                    tailBlock_.store(nextBlock, std::memory_order_release);
+                    tailIndex_.store(tail + 2, std::memory_order_release);
+                    block->next.store(nextBlock, std::memory_order_release);
+                    nextBlock = nullptr;
+                }
+                Slot& slot = block->slots[offset];
+                new (&slot.task) Task(std::forward<F>(f));
+                slot.state.store(kWritten, std::memory_order_release);
+                break;
+            }
+            block = tailBlock_.load(std::memory_order_acquire);
+        }
+        if (nextBlock) {
+            recycleBlock(nextBlock);
+        }
+    }
+
+    /**
+     * @brief Get a task from the queue.
+     *
+     * @param output
+     * @return false if the queue is empty.
+     * @note This method must be called in a single thread.
+     */
+    bool dequeue(Task& output) {
+        if (headIndex_ == tailIndex_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        size_t offset = headIndex_ % kLap;
+        assert(offset < kBlockCap);
+        Block* block = headBlock_;
+        Slot& slot = block->slots[offset];
+        // The producer which has claimed the slot may not have written it yet.
+        while (slot.state.load(std::memory_order_acquire) != kWritten) {
+            std::this_thread::yield();
+        }
+        output = std::move(slot.task);
+        slot.task.~Task();
+        if (offset + 1 == kBlockCap) {
+            Block* next;
+            while ((next = block->next.load(std::memory_order_acquire)) == nullptr) {
+                std::this_thread::yield();
+            }
+            headBlock_ = next;
+            headIndex_ += 2;
+            recycleBlock(block);
+        } else {
+            ++headIndex_;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Return true if the queue is empty.
+     *
+     * @note This method must be called in the consumer thread.
+     */
+    bool empty() const {
+        return headIndex_ == tailIndex_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Return the number of tasks in the queue, including the ones whose
+     * slots are claimed but not written yet.
+     *
+     * @note This method must be called in the consumer thread.
+     */
+    size_t size() const {
+        size_t tail = tailIndex_.load(std::memory_order_acquire);
+        // Every lap has one sentinel index which holds no task.
+        return (tail - tail / kLap) - (headIndex_ - headIndex_ / kLap);
+    }
+
+private:
+    // One lap of indices per block, the last index of a lap is a sentinel
+    // which means the next block is being installed.
+    static constexpr size_t kLap = 32;
+    static constexpr size_t kBlockCap = kLap - 1;
+    static constexpr uint32_t kWritten = 1;
+
+    struct alignas(64) Slot {
+        union {
+            Task task;
+        };
+        std::atomic<uint32_t> state{0};
+        Slot() {
+        }
+        ~Slot() {
+        }
+    };
+
+    struct Block {
+        Slot slots[kBlockCap];
+        std::atomic<Block*> next{nullptr};
+    };
+
+    Block* newBlock() {
+        Block* block = spareBlock_.exchange(nullptr, std::memory_order_acquire);
+        return block ? block : new Block;
+    }
+
+    void recycleBlock(Block* block) {
+        for (auto& slot : block->slots) {
+            slot.state.store(0, std::memory_order_relaxed);
+        }
+        block->next.store(nullptr, std::memory_order_relaxed);
+        Block* expected = nullptr;
+        if (!spareBlock_.compare_exchange_strong(expected, block, std::memory_order_release,
+                                                 std::memory_order_relaxed)) {
+            delete block;
+        }
+    }
+
+    alignas(64) std::atomic<size_t> tailIndex_{0};
+    std::atomic<Block*> tailBlock_;
+    alignas(64) size_t headIndex_{0};
+    Block* headBlock_;
+    alignas(64) std::atomic<Block*> spareBlock_{nullptr};
+};
+
+}  // namespace cooper
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef util_TokenBucket_hpp
+#define util_TokenBucket_hpp
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+
+#include "cooper/util/NonCopyable.hpp"
+
+namespace cooper {
+/**
+ * @brief This class represents a token bucket, which is filled with `rate`
+ * tokens per second up to `burst` tokens. One token stands for one byte.
+ * @note The bucket can be shared by the threads. The tokens taken by the
+ * threads at the same time may exceed the available ones, the bucket then
+ * goes into debt, which is paid back before any token is available again.
+ */
+class TokenBucket : public NonCopyable {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @brief Construct a full bucket.
+     *
+     * @param rate The number of tokens added per second, must be positive.
+     * @param burst The capacity of the bucket, one tenth of the rate if 0.
+     */
+    TokenBucket(size_t rate, size_t burst = 0) {
+        reset(rate, burst);
+    }
+
+    /**
+     * @brief Change the rate and the capacity of the bucket and fill it up.
+     *
+     * @param rate
+     * @param burst
+     */
+    void reset(size_t rate, size_t burst = 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        rate_ = std::max<size_t>(rate, 1);
+        burst_ = burst > 0 ? burst : std::max<size_t>(rate_ / 10, 1);
+        tokens_ = static_cast<double>(burst_);
+        lastRefill_ = Clock::now();
+    }
+
+    /**
+     * @brief Return the number of tokens available now.
+     *
+     * @return size_t
+     */
+    size_t available() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        refill();
+        return tokens_ > 0 ? static_cast<size_t>(tokens_) : 0;
+    }
+
+    /**
+     * @brief Take tokens from the bucket, even if fewer are available.
+     *
+     * @param n
+     */
+    void consume(size_t n) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        refill();
+        tokens_ -= static_cast<double>(n);
+    }
+
+    /**
+     * @brief Return the number of seconds until the given number of tokens are
+     * available, the number is limited to the capacity of the bucket.
+     *
+     * @param n
+     * @return double
+     */
+    double delayUntil(size_t n) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        refill();
+        double needed = static_cast<double>(std::min(n, burst_)) - tokens_;
+        return needed > 0 ? needed / static_cast<double>(rate_) : 0;
+    }
+
+    size_t rate() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return rate_;
+    }
+
+    size_t burst() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return burst_;
+    }
+
+private:
+    void refill() {
+        auto now = Clock::now();
+        double elapsed = std::chrono::duration<double>(now - lastRefill_).count();
+        lastRefill_ = now;
+        tokens_ = std::min(tokens_ + elapsed * static_cast<double>(rate_), static_cast<double>(burst_));
+    }
+
+    mutable std::mutex mutex_;
+    size_t rate_{1};
+    size_t burst_{1};
+    double tokens_{0};
+    Clock::time_point lastRefill_;
+};
+}  // namespace cooper
+
+#endif
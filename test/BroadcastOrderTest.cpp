@@ -0,0 +1,125 @@
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cooper/net/EventLoopThread.hpp>
+#include <cooper/net/TcpClient.hpp>
+#include <cooper/net/TcpServer.hpp>
+#include <cooper/util/Logger.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cooper;
+
+// Usage: BroadcastOrderTest [rounds] [clients]
+//
+// Checks that TcpServer::broadcast() keeps its place among the sends to each
+// connection. A thread that is not an event loop sends A to every connection,
+// broadcasts B, and sends C to every connection, round after round. Each
+// message carries a sequence number, which every client checks to be
+// consecutive.
+
+static const uint16_t kPort = 8898;
+
+static std::string makeMessage(uint64_t seq) {
+    // A large message now and then fills up the socket buffers,
+    // so that some sends are queued.
+    size_t length = seq % 97 == 0 ? 64 * 1024 : 16 + seq % 200;
+    std::string msg(length, static_cast<char>(seq));
+    uint32_t len32 = static_cast<uint32_t>(length);
+    memcpy(&msg[0], &len32, sizeof(len32));
+    memcpy(&msg[4], &seq, sizeof(seq));
+    return msg;
+}
+
+int main(int argc, char* argv[]) {
+    uint64_t rounds = argc > 1 ? atol(argv[1]) : 2000;
+    int clientNum = argc > 2 ? atoi(argv[2]) : 8;
+    Logger::setLogLevel(Logger::kWarn);
+
+    EventLoopThread serverThread("server");
+    serverThread.run();
+    TcpServer server(serverThread.getLoop(), InetAddress(kPort), "BroadcastOrderTest");
+    std::mutex mutex;
+    std::vector<TcpConnectionPtr> conns;
+    server.setConnectionCallback([&](const TcpConnectionPtr& conn) {
+        if (conn->connected()) {
+            std::lock_guard<std::mutex> guard(mutex);
+            conns.push_back(conn);
+        }
+    });
+    server.setIoLoopNum(2);
+    server.start();
+
+    EventLoopThread clientThread("client");
+    clientThread.run();
+    uint64_t total = rounds * 3;
+    std::atomic<int> finished{0};
+    std::atomic<int> failed{0};
+    std::promise<void> done;
+    std::vector<std::shared_ptr<TcpClient>> clients;
+    for (int i = 0; i < clientNum; ++i) {
+        auto expected = std::make_shared<uint64_t>(0);
+        auto client = std::make_shared<TcpClient>(clientThread.getLoop(), InetAddress("127.0.0.1", kPort), "client");
+        client->setMessageCallback([&, expected](const TcpConnectionPtr&, MsgBuffer* buffer) {
+            while (buffer->readableBytes() >= 12) {
+                uint32_t length;
+                uint64_t seq;
+                memcpy(&length, buffer->peek(), sizeof(length));
+                if (buffer->readableBytes() < length) {
+                    return;
+                }
+                memcpy(&seq, buffer->peek() + 4, sizeof(seq));
+                buffer->retrieve(length);
+                if (seq != *expected) {
+                    printf("ERROR: message %llu received, %llu expected\n", static_cast<unsigned long long>(seq),
+                           static_cast<unsigned long long>(*expected));
+                    ++failed;
+                    *expected = seq;
+                }
+                if (++*expected == total && ++finished == clientNum) {
+                    done.set_value();
+                }
+            }
+        });
+        client->connect();
+        clients.push_back(client);
+    }
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            if (static_cast<int>(conns.size()) == clientNum) {
+                break;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    for (uint64_t round = 0; round < rounds; ++round) {
+        std::string a = makeMessage(round * 3);
+        for (auto& conn : conns) {
+            conn->send(a);
+        }
+        server.broadcast(std::make_shared<const std::string>(makeMessage(round * 3 + 1)), conns);
+        std::string c = makeMessage(round * 3 + 2);
+        for (auto& conn : conns) {
+            conn->send(c);
+        }
+    }
+    if (done.get_future().wait_for(std::chrono::seconds(60)) != std::future_status::ready) {
+        printf("ERROR: timed out, %d of %d clients finished\n", finished.load(), clientNum);
+        exit(1);
+    }
+    printf("%s: %llu messages to each of %d clients\n", failed == 0 ? "OK" : "FAILED",
+           static_cast<unsigned long long>(total), clientNum);
+    // The connections are closed with the process.
+    fflush(stdout);
+    _exit(failed == 0 ? 0 : 1);
+}
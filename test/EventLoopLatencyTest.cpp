@@ -0,0 +1,125 @@
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cooper/net/EventLoopThread.hpp>
+#include <cooper/net/TcpServer.hpp>
+#include <cooper/util/Logger.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cooper;
+
+// Usage: EventLoopLatencyTest [samples] [interval_us] [spin_us] [busy_poll_us]
+//
+// Measures the round trip time of a 64-byte ping-pong over loopback TCP, with
+// the I/O loop of the echo server blocking in the poller and spinning.
+
+static const uint16_t kPort = 8899;
+static const size_t kMessageSize = 64;
+
+static std::vector<int64_t> measure(size_t samples, int intervalUs) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(kPort);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+        LOG_SYSERR << "connect";
+        exit(1);
+    }
+    char buf[kMessageSize] = {0};
+    std::vector<int64_t> rtts;
+    rtts.reserve(samples);
+    for (size_t i = 0; i < samples + samples / 10; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        if (::write(fd, buf, sizeof(buf)) != static_cast<ssize_t>(sizeof(buf))) {
+            LOG_SYSERR << "write";
+            exit(1);
+        }
+        size_t got = 0;
+        while (got < sizeof(buf)) {
+            ssize_t n = ::read(fd, buf + got, sizeof(buf) - got);
+            if (n <= 0) {
+                LOG_SYSERR << "read";
+                exit(1);
+            }
+            got += n;
+        }
+        auto end = std::chrono::steady_clock::now();
+        // The first 10% of samples are for warming up.
+        if (i >= samples / 10) {
+            rtts.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        }
+        if (intervalUs > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(intervalUs));
+        }
+    }
+    ::close(fd);
+    return rtts;
+}
+
+static void report(const char* name, std::vector<int64_t>& rtts) {
+    std::sort(rtts.begin(), rtts.end());
+    auto percentile = [&rtts](double p) {
+        return rtts[std::min(rtts.size() - 1, static_cast<size_t>(p * rtts.size()))] / 1000.0;
+    };
+    printf("%s: samples=%zu p50=%.1fus p90=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus\n", name, rtts.size(),
+           percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999), rtts.back() / 1000.0);
+    // log2 histogram in microseconds
+    std::vector<size_t> buckets(32, 0);
+    for (auto rtt : rtts) {
+        size_t us = static_cast<size_t>(rtt / 1000);
+        size_t b = 0;
+        while (us > 0 && b < buckets.size() - 1) {
+            us >>= 1;
+            ++b;
+        }
+        ++buckets[b];
+    }
+    for (size_t b = 0; b < buckets.size(); ++b) {
+        if (buckets[b] == 0)
+            continue;
+        size_t bars = buckets[b] * 60 / rtts.size();
+        printf("  < %6zuus %8zu %s\n", static_cast<size_t>(1) << b, buckets[b], std::string(bars, '#').c_str());
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Logger::setLogLevel(Logger::kWarn);
+    size_t samples = argc > 1 ? atol(argv[1]) : 20000;
+    int intervalUs = argc > 2 ? atoi(argv[2]) : 100;
+    int spinUs = argc > 3 ? atoi(argv[3]) : 1000;
+    int busyPollUs = argc > 4 ? atoi(argv[4]) : 0;
+
+    for (int spinning = 0; spinning < 2; ++spinning) {
+        EventLoopThread loopThread;
+        loopThread.run();
+        TcpServer server(loopThread.getLoop(), InetAddress(kPort), "EventLoopLatencyTest");
+        server.setRecvMessageCallback([](const TcpConnectionPtr& conn, MsgBuffer* buffer) {
+            conn->send(buffer->peek(), buffer->readableBytes());
+            buffer->retrieveAll();
+        });
+        server.setIoLoopNum(1);
+        if (spinning) {
+            server.getIoLoops()[0]->setSpinDuration(std::chrono::microseconds(spinUs));
+            if (busyPollUs > 0)
+                server.setBusyPoll(busyPollUs);
+        }
+        server.start();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        auto rtts = measure(samples, intervalUs);
+        report(spinning ? "spinning" : "blocking", rtts);
+        server.stop();
+    }
+}
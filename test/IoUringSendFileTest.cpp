@@ -0,0 +1,108 @@
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cooper/net/EventLoopThread.hpp>
+#include <cooper/net/TcpClient.hpp>
+#include <cooper/net/TcpServer.hpp>
+#include <cooper/util/Logger.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <string>
+
+using namespace cooper;
+
+// Usage: IoUringSendFileTest [responses]
+//
+// Checks the sends of a file after some data on the io_uring poller, the way
+// HttpServer sends a file response: send() of a header followed by
+// sendFile(). Every connection receives the header and the file, which the
+// client checks byte by byte.
+
+static const uint16_t kPort = 8897;
+static const size_t kFileSize = 200000;
+
+static char fileByte(size_t i) {
+    return static_cast<char>('a' + i % 26);
+}
+
+int main(int argc, char* argv[]) {
+    int responses = argc > 1 ? atoi(argv[1]) : 20;
+    Logger::setLogLevel(Logger::kWarn);
+
+    char fileName[] = "/tmp/IoUringSendFileTestXXXXXX";
+    int fd = mkstemp(fileName);
+    if (fd < 0) {
+        LOG_SYSERR << "mkstemp";
+        return 1;
+    }
+    std::string content(kFileSize, 0);
+    for (size_t i = 0; i < kFileSize; ++i) {
+        content[i] = fileByte(i);
+    }
+    if (write(fd, content.data(), content.size()) != static_cast<ssize_t>(content.size())) {
+        LOG_SYSERR << "write";
+        return 1;
+    }
+    close(fd);
+
+    const std::string header = "HEADER\r\n";
+    EventLoopThread serverThread("server", PollerType::kIoUring);
+    serverThread.run();
+    if (serverThread.getLoop()->pollerType() != PollerType::kIoUring) {
+        printf("SKIPPED: io_uring is not available\n");
+        unlink(fileName);
+        return 0;
+    }
+    TcpServer server(serverThread.getLoop(), InetAddress(kPort), "IoUringSendFileTest");
+    server.setConnectionCallback([&](const TcpConnectionPtr& conn) {
+        if (conn->connected()) {
+            conn->send(header);
+            conn->sendFile(fileName);
+            conn->shutdown();
+        }
+    });
+    server.setIoLoopNum(1, PollerType::kIoUring);
+    server.start();
+
+    std::string expected = header + content;
+    EventLoopThread clientThread("client");
+    clientThread.run();
+    std::atomic<int> finished{0};
+    std::atomic<int> failed{0};
+    std::promise<void> done;
+    std::vector<std::shared_ptr<TcpClient>> clients;
+    for (int i = 0; i < responses; ++i) {
+        auto received = std::make_shared<std::string>();
+        auto client = std::make_shared<TcpClient>(clientThread.getLoop(), InetAddress("127.0.0.1", kPort), "client");
+        client->setMessageCallback([received](const TcpConnectionPtr&, MsgBuffer* buffer) {
+            received->append(buffer->peek(), buffer->readableBytes());
+            buffer->retrieveAll();
+        });
+        client->setConnectionCallback([&, received](const TcpConnectionPtr& conn) {
+            if (conn->connected()) {
+                return;
+            }
+            if (*received != expected) {
+                printf("ERROR: %zu bytes received, %zu expected\n", received->size(), expected.size());
+                ++failed;
+            }
+            if (++finished == responses) {
+                done.set_value();
+            }
+        });
+        client->connect();
+        clients.push_back(client);
+    }
+    bool timedOut = done.get_future().wait_for(std::chrono::seconds(30)) != std::future_status::ready;
+    unlink(fileName);
+    if (timedOut) {
+        printf("ERROR: timed out, %d of %d responses received\n", finished.load(), responses);
+        exit(1);
+    }
+    printf("%s: %d responses of %zu bytes\n", failed == 0 ? "OK" : "FAILED", responses, expected.size());
+    // The connections are closed with the process.
+    fflush(stdout);
+    _exit(failed == 0 ? 0 : 1);
+}
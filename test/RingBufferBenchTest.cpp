@@ -0,0 +1,129 @@
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cooper/util/MsgBuffer.hpp>
+#include <cooper/util/RingBuffer.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace cooper;
+
+// Usage: RingBufferBenchTest [megabytes] [chunk size]
+//
+// Measures the throughput of receiving a stream of pipelined messages, each
+// one a 4-byte length and a payload, comparing MsgBuffer with RingBuffer. The
+// stream is appended in chunks of the size of a socket read, and after each
+// chunk the complete messages are taken out through a contiguous view, which
+// leaves the beginning of the next message in the buffer. MsgBuffer moves it
+// to the front when it runs out of room at the end, RingBuffer copies only the
+// messages that wrap around the end of the ring.
+
+struct MsgBufferAdaptor {
+    MsgBuffer buffer;
+    uint32_t peekLength() const {
+        uint32_t length;
+        memcpy(&length, buffer.peek(), 4);
+        return length;
+    }
+    int checksum(uint32_t length) const {
+        const char* message = buffer.peek();
+        return message[4] + message[3 + length];
+    }
+};
+
+struct RingBufferAdaptor {
+    RingBuffer buffer;
+    uint32_t peekLength() const {
+        uint32_t length;
+        memcpy(&length, buffer.peek(4), 4);
+        return length;
+    }
+    int checksum(uint32_t length) const {
+        const char* message = buffer.peek(4 + length);
+        return message[4] + message[3 + length];
+    }
+};
+
+// Reads the messages in place through RingBuffer::peekSegments(), so nothing
+// is copied besides appending.
+struct RingSegmentsAdaptor {
+    RingBuffer buffer;
+    static char at(const struct iovec* vec, size_t offset) {
+        if (offset < vec[0].iov_len)
+            return static_cast<const char*>(vec[0].iov_base)[offset];
+        return static_cast<const char*>(vec[1].iov_base)[offset - vec[0].iov_len];
+    }
+    uint32_t peekLength() const {
+        struct iovec vec[2];
+        buffer.peekSegments(vec);
+        char bytes[4]{at(vec, 0), at(vec, 1), at(vec, 2), at(vec, 3)};
+        uint32_t length;
+        memcpy(&length, bytes, 4);
+        return length;
+    }
+    int checksum(uint32_t length) const {
+        struct iovec vec[2];
+        buffer.peekSegments(vec);
+        return at(vec, 4) + at(vec, 3 + length);
+    }
+};
+
+static std::vector<char> makeStream(uint32_t messageSize) {
+    size_t recordSize = 4 + messageSize;
+    size_t records = std::max<size_t>(4 * 1024 * 1024 / recordSize, 4);
+    std::vector<char> stream(records * recordSize);
+    for (size_t i = 0; i < records; ++i) {
+        char* record = stream.data() + i * recordSize;
+        memcpy(record, &messageSize, 4);
+        memset(record + 4, static_cast<int>(i & 0x7f), messageSize);
+    }
+    return stream;
+}
+
+template <typename Buffer>
+double run(const std::vector<char>& stream, size_t chunkSize, size_t totalBytes, uint64_t* sum) {
+    Buffer buffer;
+    size_t pos = 0;
+    *sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t fed = 0; fed < totalBytes;) {
+        size_t len = std::min(chunkSize, stream.size() - pos);
+        buffer.buffer.append(stream.data() + pos, len);
+        pos = (pos + len) % stream.size();
+        fed += len;
+        while (buffer.buffer.readableBytes() >= 4) {
+            uint32_t messageSize = buffer.peekLength();
+            if (buffer.buffer.readableBytes() < 4 + messageSize) {
+                break;
+            }
+            *sum += buffer.checksum(messageSize);
+            buffer.buffer.retrieve(4 + messageSize);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    return totalBytes / std::chrono::duration<double>(end - start).count() / 1e6;
+}
+
+int main(int argc, char* argv[]) {
+    size_t totalBytes = (argc > 1 ? atol(argv[1]) : 1024) * 1024 * 1024;
+    size_t chunkSize = argc > 2 ? atol(argv[2]) : 64 * 1024;
+    printf("%-14s %14s %14s %14s\n", "message size", "MsgBuffer", "RingBuffer", "ring segments");
+    for (uint32_t messageSize : {60, 1020, 16380, 49148, 196604}) {
+        auto stream = makeStream(messageSize);
+        uint64_t msgSum, ringSum, segmentsSum;
+        double msg = run<MsgBufferAdaptor>(stream, chunkSize, totalBytes, &msgSum);
+        double ring = run<RingBufferAdaptor>(stream, chunkSize, totalBytes, &ringSum);
+        double segments = run<RingSegmentsAdaptor>(stream, chunkSize, totalBytes, &segmentsSum);
+        if (ringSum != msgSum || segmentsSum != msgSum) {
+            printf("ERROR: checksums %llu and %llu of RingBuffer, %llu expected\n",
+                   static_cast<unsigned long long>(ringSum), static_cast<unsigned long long>(segmentsSum),
+                   static_cast<unsigned long long>(msgSum));
+            exit(1);
+        }
+        printf("%-14u %9.0f MB/s %9.0f MB/s %9.0f MB/s\n", messageSize + 4, msg, ring, segments);
+    }
+}
@@ -0,0 +1,108 @@
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cooper/util/LockFreeQueue.hpp>
+#include <cooper/util/TaskQueue.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <thread>
+#include <vector>
+
+using namespace cooper;
+
+// Usage: TaskQueueBenchTest [tasks]
+//
+// Measures the throughput of enqueuing tasks from 1-32 producer threads and
+// dequeuing them in a single consumer thread, comparing MpscQueue<Func> with
+// TaskQueue. The "small" tasks capture a pointer and an integer, which is
+// typical for queueInLoop(). The "large" tasks capture 64 bytes, which
+// overflows the inline storage of both std::function and Task.
+
+struct MpscAdaptor {
+    MpscQueue<std::function<void()>> queue;
+    template <typename F>
+    void enqueue(F&& f) {
+        queue.enqueue(std::function<void()>(std::forward<F>(f)));
+    }
+    bool runOne() {
+        std::function<void()> f;
+        if (!queue.dequeue(f))
+            return false;
+        f();
+        return true;
+    }
+};
+
+struct TaskQueueAdaptor {
+    TaskQueue queue;
+    template <typename F>
+    void enqueue(F&& f) {
+        queue.enqueue(std::forward<F>(f));
+    }
+    bool runOne() {
+        Task task;
+        if (!queue.dequeue(task))
+            return false;
+        task();
+        return true;
+    }
+};
+
+template <typename Queue, bool large>
+double run(size_t producers, size_t tasks) {
+    Queue queue;
+    uint64_t sum = 0;
+    std::atomic<bool> go{false};
+    std::vector<std::thread> threads;
+    size_t perProducer = tasks / producers;
+    for (size_t p = 0; p < producers; ++p) {
+        threads.emplace_back([&queue, &sum, &go, perProducer]() {
+            while (!go.load(std::memory_order_acquire)) {
+            }
+            for (size_t i = 0; i < perProducer; ++i) {
+                if (large) {
+                    std::array<uint64_t, 7> payload;
+                    payload.fill(1);
+                    queue.enqueue([&sum, payload]() {
+                        sum += payload[0];
+                    });
+                } else {
+                    queue.enqueue([&sum]() {
+                        ++sum;
+                    });
+                }
+            }
+        });
+    }
+    auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    size_t total = perProducer * producers;
+    size_t done = 0;
+    while (done < total) {
+        if (queue.runOne())
+            ++done;
+    }
+    auto end = std::chrono::steady_clock::now();
+    for (auto& t : threads) {
+        t.join();
+    }
+    if (sum != total) {
+        printf("ERROR: %llu tasks run, %zu expected\n", static_cast<unsigned long long>(sum), total);
+        exit(1);
+    }
+    return total / std::chrono::duration<double>(end - start).count() / 1e6;
+}
+
+int main(int argc, char* argv[]) {
+    size_t tasks = argc > 1 ? atol(argv[1]) : 2000000;
+    printf("%-10s %12s %12s %12s %12s\n", "producers", "mpsc small", "task small", "mpsc large", "task large");
+    for (size_t producers = 1; producers <= 32; producers *= 2) {
+        double mpscSmall = run<MpscAdaptor, false>(producers, tasks);
+        double taskSmall = run<TaskQueueAdaptor, false>(producers, tasks);
+        double mpscLarge = run<MpscAdaptor, true>(producers, tasks);
+        double taskLarge = run<TaskQueueAdaptor, true>(producers, tasks);
+        printf("%-10zu %9.2f M/s %9.2f M/s %9.2f M/s %9.2f M/s\n", producers, mpscSmall, taskSmall, mpscLarge,
+               taskLarge);
+    }
+}